@@ -51,10 +51,6 @@ void setup() {
 
 void loop() {
   
-	// check to see if a UDP packet arrived at the TFTP port
-  	if (tftpServer.checkForPacket()) {
-		
-		// if we found a packet then handle the request
-		tftpServer.processRequest();
-	}
+	// start new transfers and move the ones in progress forward without blocking
+	tftpServer.poll();
 }
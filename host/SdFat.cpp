@@ -0,0 +1,417 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name SdFat.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <SdFat.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+/**
+ * @struct extent_t
+ * A run of made-up sectors standing for a file
+ */
+struct extent_t {
+	uint32_t first;
+	uint32_t count;
+	std::string path;
+};
+
+std::vector <extent_t> extents;
+uint32_t nextSector = 8192;
+
+// the multi-block transfer in progress, if any
+int streamFd = -1;
+bool streamWriting = false;
+uint32_t streamSector = 0;
+size_t streamExtent = 0;
+
+// names in the order they were first seen, the position is the directory entry number
+std::vector <std::string> dirEntries;
+
+// a real card can't take other commands in the middle of a multi-block transfer
+void checkIdle (const char* call) {
+
+	if (streamFd >= 0) fprintf (stderr, "SdFat: %s during a multi-block transfer\n", call);
+}
+
+// the sectors of a file, made up the first time they are asked for
+const extent_t& extentFor (const std::string& path, uint32_t size) {
+
+	uint32_t count = (size + 511) / 512;
+
+	if (count == 0) count = 1;
+
+	for (size_t i = 0; i < extents.size(); ++i) {
+
+		if (extents[i].path == path && extents[i].count >= count) return extents[i];
+	}
+
+	extent_t extent = { nextSector, count, path };
+
+	nextSector += count;
+	extents.push_back (extent);
+
+	return extents.back();
+}
+
+// open the file behind a sector for a multi-block transfer
+bool streamStart (uint32_t blockNumber, bool writing) {
+
+	if (streamFd >= 0) return false;
+
+	for (size_t i = 0; i < extents.size(); ++i) {
+
+		const extent_t& extent = extents[i];
+
+		if (blockNumber >= extent.first && blockNumber < extent.first + extent.count) {
+
+			streamFd = ::open (extent.path.c_str(), writing ? O_WRONLY : O_RDONLY);
+			streamWriting = writing;
+			streamSector = blockNumber;
+			streamExtent = i;
+
+			return streamFd >= 0;
+		}
+	}
+
+	return false;
+}
+
+bool streamStop (bool writing) {
+
+	if (streamFd < 0 || streamWriting != writing) return false;
+
+	::close (streamFd);
+	streamFd = -1;
+
+	return true;
+}
+
+}
+
+
+File& File::operator= (File&& other) {
+
+	if (this != &other) {
+
+		close();
+
+		m_fd = other.m_fd;
+		m_path = other.m_path;
+		m_dir = other.m_dir;
+		other.m_fd = -1;
+		other.m_dir = NULL;
+	}
+
+	return *this;
+}
+
+bool File::open (const char* path, int oflag) {
+
+	close();
+
+	checkIdle ("open");
+
+	// the root of the card is the working directory
+	m_path = (strcmp (path, "/") == 0) ? "." : path;
+
+	m_fd = ::open (m_path.c_str(), oflag, 0644);
+
+	return m_fd >= 0;
+}
+
+bool File::open (File* /* dirFile */, uint16_t index, int oflag) {
+
+	if (index >= dirEntries.size()) {
+
+		close();
+
+		return false;
+	}
+
+	return open (dirEntries[index].c_str(), oflag);
+}
+
+// regular files and directories, like the entries of a FAT directory
+bool File::openNext (File* dirFile, int oflag) {
+
+	close();
+
+	if (dirFile->m_dir == NULL) dirFile->m_dir = opendir (dirFile->m_path.c_str());
+
+	if (dirFile->m_dir == NULL) return false;
+
+	while (struct dirent* entry = readdir (dirFile->m_dir)) {
+
+		if (strcmp (entry->d_name, ".") == 0 || strcmp (entry->d_name, "..") == 0) continue;
+
+		std::string path = (dirFile->m_path == ".") ? entry->d_name : dirFile->m_path + "/" + entry->d_name;
+
+		if (open (path.c_str(), oflag)) return true;
+	}
+
+	return false;
+}
+
+// like SdFat the file gets its full size right away
+bool File::createContiguous (const char* path, uint32_t size) {
+
+	if (!open (path, O_RDWR | O_CREAT | O_EXCL)) return false;
+
+	if (size == 0 || fallocate (m_fd, 0, 0, size) != 0) {
+
+		close();
+		unlink (path);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool File::close() {
+
+	if (m_dir != NULL) closedir (m_dir);
+
+	m_dir = NULL;
+
+	if (m_fd < 0) return false;
+
+	::close (m_fd);
+	m_fd = -1;
+
+	return true;
+}
+
+int File::read() {
+
+	uint8_t c;
+
+	return (read (&c, 1) == 1) ? c : -1;
+}
+
+int File::read (void* buffer, size_t count) {
+
+	checkIdle ("read");
+
+	return static_cast <int> (::read (m_fd, buffer, count));
+}
+
+int File::write (const void* buffer, size_t count) {
+
+	checkIdle ("write");
+
+	return static_cast <int> (::write (m_fd, buffer, count));
+}
+
+bool File::sync() {
+
+	checkIdle ("sync");
+
+	return fsync (m_fd) == 0;
+}
+
+bool File::seekSet (uint32_t position) {
+
+	return lseek (m_fd, position, SEEK_SET) == static_cast <off_t> (position);
+}
+
+uint32_t File::curPosition() {
+
+	return static_cast <uint32_t> (lseek (m_fd, 0, SEEK_CUR));
+}
+
+uint32_t File::fileSize() {
+
+	struct stat status;
+
+	return (fstat (m_fd, &status) == 0) ? static_cast <uint32_t> (status.st_size) : 0;
+}
+
+// the modification time is packed into the date and time fields so any change shows
+bool File::dirEntry (dir_t* dir) {
+
+	struct stat status;
+
+	if (fstat (m_fd, &status) != 0) return false;
+
+	dir->lastWriteDate = static_cast <uint16_t> (status.st_mtime >> 16);
+	dir->lastWriteTime = static_cast <uint16_t> (status.st_mtime);
+	dir->fileSize = static_cast <uint32_t> (status.st_size);
+
+	return true;
+}
+
+bool File::truncate (uint32_t length) {
+
+	checkIdle ("truncate");
+
+	return ftruncate (m_fd, length) == 0;
+}
+
+bool File::contiguousRange (uint32_t* bgnBlock, uint32_t* endBlock) {
+
+	if (m_fd < 0) return false;
+
+	const extent_t& extent = extentFor (m_path, fileSize());
+
+	*bgnBlock = extent.first;
+	*endBlock = extent.first + extent.count - 1;
+
+	return true;
+}
+
+bool File::isDir() {
+
+	struct stat status;
+
+	return fstat (m_fd, &status) == 0 && S_ISDIR (status.st_mode);
+}
+
+bool File::getName (char* name, size_t size) {
+
+	size_t slash = m_path.rfind ('/');
+	std::string base = (slash == std::string::npos) ? m_path : m_path.substr (slash + 1);
+
+	if (m_fd < 0 || base.size() >= size) return false;
+
+	strcpy (name, base.c_str());
+
+	return true;
+}
+
+uint16_t File::dirIndex() {
+
+	for (size_t i = 0; i < dirEntries.size(); ++i) {
+
+		if (dirEntries[i] == m_path) return static_cast <uint16_t> (i);
+	}
+
+	dirEntries.push_back (m_path);
+
+	return static_cast <uint16_t> (dirEntries.size() - 1);
+}
+
+bool SdSpiCard::readStart (uint32_t blockNumber) {
+
+	return streamStart (blockNumber, false);
+}
+
+// past the end of the file reads as zeros
+bool SdSpiCard::readData (uint8_t* dst) {
+
+	if (streamFd < 0 || streamWriting || streamSector >= extents[streamExtent].first + extents[streamExtent].count) return false;
+
+	ssize_t length = pread (streamFd, dst, 512, static_cast <off_t> (streamSector - extents[streamExtent].first) * 512);
+
+	if (length < 0) return false;
+
+	memset (&dst[length], 0, 512 - length);
+
+	streamSector++;
+
+	return true;
+}
+
+bool SdSpiCard::readStop() {
+
+	return streamStop (false);
+}
+
+bool SdSpiCard::writeStart (uint32_t blockNumber) {
+
+	return streamStart (blockNumber, true);
+}
+
+bool SdSpiCard::writeStart (uint32_t blockNumber, uint32_t /* eraseCount */) {
+
+	return streamStart (blockNumber, true);
+}
+
+bool SdSpiCard::writeData (const uint8_t* src) {
+
+	if (streamFd < 0 || !streamWriting || streamSector >= extents[streamExtent].first + extents[streamExtent].count) return false;
+
+	if (pwrite (streamFd, src, 512, static_cast <off_t> (streamSector - extents[streamExtent].first) * 512) != 512) return false;
+
+	streamSector++;
+
+	return true;
+}
+
+bool SdSpiCard::writeStop() {
+
+	return streamStop (true);
+}
+
+int32_t FatVolume::freeClusterCount() {
+
+	struct statvfs status;
+
+	if (statvfs (".", &status) != 0) return -1;
+
+	// one cluster per file system block, capped like a FAT32 cluster count
+	uint64_t clusters = static_cast <uint64_t> (status.f_bavail) * status.f_frsize / (blocksPerCluster() * 512ULL);
+
+	return (clusters > 0x0FFFFFFF) ? 0x0FFFFFFF : static_cast <int32_t> (clusters);
+}
+
+uint8_t FatVolume::blocksPerCluster() {
+
+	return 64;
+}
+
+bool SdFat::exists (const char* path) {
+
+	checkIdle ("exists");
+
+	struct stat status;
+
+	return stat (path, &status) == 0;
+}
+
+bool SdFat::remove (const char* path) {
+
+	checkIdle ("remove");
+
+	return unlink (path) == 0;
+}
+
+File SdFat::open (const char* path, int oflag) {
+
+	File file;
+
+	file.open (path, oflag);
+
+	return file;
+}
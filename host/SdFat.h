@@ -0,0 +1,172 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name SdFat.h
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief Host stand-in for the parts of SdFat used by the TFTP server
+ *
+ * Only used by the Linux build.  Files live in the directory the process runs in
+ * and map straight onto POSIX file descriptors, flags follow SdFat's fcntl.h style.
+ *
+ * Every file looks contiguous.  contiguousRange() hands out a made-up run of sectors
+ * for it, and the multi-block calls of SdSpiCard read and write the file behind those
+ * sectors.  Touching the file system while a multi-block transfer is open is reported
+ * on stderr since a real card would get confused.
+ *
+ * The root directory "/" is the working directory.  Directory entry numbers are made
+ * up the first time a file is seen and stay with its name.
+ */
+
+#ifndef _TFTP_HOST_SDFAT_H_
+#define _TFTP_HOST_SDFAT_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <string>
+
+#define O_READ O_RDONLY
+#define O_WRITE O_WRONLY
+
+/**
+ * @struct dir_t
+ * The directory entry fields the server looks at
+ */
+struct dir_t {
+	uint16_t lastWriteTime;
+	uint16_t lastWriteDate;
+	uint32_t fileSize;
+};
+
+/**
+ * @class File
+ * An open file.  Can be moved but not copied since it owns its descriptor.
+ */
+class File {
+
+public:
+
+	File() : m_fd(-1), m_dir(NULL) {}
+	File(File&& other) : m_fd(other.m_fd), m_path(other.m_path), m_dir(other.m_dir) { other.m_fd = -1; other.m_dir = NULL; }
+	File& operator=(File&& other);
+	~File() { close(); }
+
+	File(const File&) = delete;
+	File& operator=(const File&) = delete;
+
+	bool open(const char* path, int oflag = O_READ);
+	bool open(File* dirFile, uint16_t index, int oflag);
+	bool openNext(File* dirFile, int oflag = O_READ);
+	bool createContiguous(const char* path, uint32_t size);
+	bool isOpen() const { return m_fd >= 0; }
+	bool close();
+
+	int read();
+	int read(void* buffer, size_t count);
+	int write(const void* buffer, size_t count);
+	bool sync();
+
+	bool seekSet(uint32_t position);
+	uint32_t curPosition();
+	uint32_t fileSize();
+
+	bool dirEntry(dir_t* dir);
+	bool truncate(uint32_t length);
+	bool contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock);
+
+	bool isDir();
+	bool getName(char* name, size_t size);
+	uint16_t dirIndex();
+
+private:
+
+	int m_fd;
+	std::string m_path;
+	DIR* m_dir;                          ///< open for openNext() on a directory
+};
+
+/**
+ * @class SdSpiCard
+ * Multi-block reads and writes on the sectors handed out by File::contiguousRange()
+ */
+class SdSpiCard {
+
+public:
+
+	bool readStart(uint32_t blockNumber);
+	bool readData(uint8_t* dst);
+	bool readStop();
+
+	bool writeStart(uint32_t blockNumber);
+	bool writeStart(uint32_t blockNumber, uint32_t eraseCount);
+	bool writeData(const uint8_t* src);
+	bool writeStop();
+};
+
+/**
+ * @class FatVolume
+ * Free space of the file system the working directory is on, in 512 byte blocks
+ */
+class FatVolume {
+
+public:
+
+	int32_t freeClusterCount();
+	uint8_t blocksPerCluster();
+	uint8_t* cacheClear() { return m_cache; }
+
+private:
+
+	uint8_t m_cache[512];
+};
+
+/**
+ * @class SdFat
+ * The file system, rooted at the current working directory
+ */
+class SdFat {
+
+public:
+
+	bool begin() { return true; }
+	bool exists(const char* path);
+	bool remove(const char* path);
+	File open(const char* path, int oflag = O_READ);
+	FatVolume* vol() { return &m_volume; }
+	SdSpiCard* card() { return &m_card; }
+
+private:
+
+	FatVolume m_volume;
+	SdSpiCard m_card;
+};
+
+#endif /* _TFTP_HOST_SDFAT_H_ */
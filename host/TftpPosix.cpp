@@ -0,0 +1,189 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpPosix.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <TftpPosix.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+bool PosixUdpSocket::begin (uint16_t port) {
+
+	stop();
+
+	m_fd = socket (AF_INET, SOCK_DGRAM, 0);
+
+	if (m_fd < 0) return false;
+
+	// never wait on a receive, the server polls
+	fcntl (m_fd, F_SETFL, fcntl (m_fd, F_GETFL) | O_NONBLOCK);
+
+	int reuse = 1;
+	setsockopt (m_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+
+	// port 0 lets the kernel pick a free ephemeral port
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons (port);
+	address.sin_addr.s_addr = htonl (m_bindAddress);
+
+	socklen_t addressLength = sizeof (address);
+
+	if (bind (m_fd, reinterpret_cast <sockaddr*> (&address), addressLength) < 0 ||
+			getsockname (m_fd, reinterpret_cast <sockaddr*> (&address), &addressLength) < 0) {
+
+		stop();
+
+		return false;
+	}
+
+	m_localPort = ntohs (address.sin_port);
+
+	return true;
+}
+
+void PosixUdpSocket::stop() {
+
+	if (m_fd >= 0) close (m_fd);
+
+	m_fd = -1;
+}
+
+int PosixUdpSocket::receivePacket (uint8_t* buffer, size_t size) {
+
+	if (m_fd < 0) return -1;
+
+	sockaddr_in address;
+	socklen_t addressLength = sizeof (address);
+
+	ssize_t length = recvfrom (m_fd, buffer, size, 0, reinterpret_cast <sockaddr*> (&address), &addressLength);
+
+	// nothing waiting is not an error
+	if (length < 0) {
+
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	}
+
+	m_remoteIp = ntohl (address.sin_addr.s_addr);
+	m_remotePort = ntohs (address.sin_port);
+
+	return static_cast <int> (length);
+}
+
+int PosixUdpSocket::sendPacket (const uint8_t* buffer, size_t length, uint32_t remoteIp, uint16_t remotePort) {
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons (remotePort);
+	address.sin_addr.s_addr = htonl (remoteIp);
+
+	return static_cast <int> (sendto (m_fd, buffer, length, 0, reinterpret_cast <sockaddr*> (&address), sizeof (address)));
+}
+
+PosixNetwork::PosixNetwork (uint32_t bindAddress) {
+
+	for (uint8_t i = 0; i < TFTP_MAX_SESSIONS + 1; ++i) {
+
+		m_sockets[i].setBindAddress (bindAddress);
+		m_inUse[i] = false;
+	}
+}
+
+TftpSocket* PosixNetwork::openSocket (uint16_t port) {
+
+	for (uint8_t i = 0; i < TFTP_MAX_SESSIONS + 1; ++i) {
+
+		if (!m_inUse[i]) {
+
+			if (!m_sockets[i].begin (port)) return NULL;
+
+			m_inUse[i] = true;
+
+			return &m_sockets[i];
+		}
+	}
+
+	return NULL;
+}
+
+void PosixNetwork::closeSocket (TftpSocket* socket) {
+
+	for (uint8_t i = 0; i < TFTP_MAX_SESSIONS + 1; ++i) {
+
+		if (socket == &m_sockets[i]) {
+
+			m_sockets[i].stop();
+			m_inUse[i] = false;
+		}
+	}
+}
+
+uint32_t PosixClock::millis() {
+
+	timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return static_cast <uint32_t> (now.tv_sec * 1000ULL + now.tv_nsec / 1000000);
+}
+
+uint32_t PosixClock::micros() {
+
+	timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return static_cast <uint32_t> (now.tv_sec * 1000000ULL + now.tv_nsec / 1000);
+}
+
+void PosixStderrLog::write (const char* text) {
+
+	fputs (text, stderr);
+}
+
+TftpNetwork& tftpDefaultNetwork() {
+
+	static PosixNetwork network;
+
+	return network;
+}
+
+TftpClock& tftpDefaultClock() {
+
+	static PosixClock clock;
+
+	return clock;
+}
+
+TftpLog& tftpDefaultLog() {
+
+	static PosixStderrLog log;
+
+	return log;
+}
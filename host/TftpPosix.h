@@ -0,0 +1,120 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpPosix.h
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief POSIX implementation of the TFTP platform interfaces
+ *
+ * Non-blocking UDP sockets, CLOCK_MONOTONIC and stderr.  These are the defaults
+ * used by TftpServer::begin() in the Linux build.
+ */
+
+#ifndef _TFTPPOSIX_H_
+#define _TFTPPOSIX_H_
+
+#include <TftpServer.h>
+
+// 127.0.0.1 with the first octet in the most significant byte
+const uint32_t TFTP_LOOPBACK_ADDRESS = 0x7F000001;
+
+/**
+ * @class PosixUdpSocket
+ */
+class PosixUdpSocket : public TftpSocket {
+
+public:
+
+	PosixUdpSocket() : m_fd(-1), m_bindAddress(TFTP_LOOPBACK_ADDRESS), m_localPort(0),
+			m_remoteIp(0), m_remotePort(0) {}
+	~PosixUdpSocket() { stop(); }
+
+	/**
+	 * @param address IPv4 address to bind to by begin()
+	 */
+	void setBindAddress(uint32_t address) { m_bindAddress = address; }
+
+	bool begin(uint16_t port);
+	void stop();
+	uint16_t localPort() { return m_localPort; }
+	int receivePacket(uint8_t* buffer, size_t size);
+	int sendPacket(const uint8_t* buffer, size_t length, uint32_t remoteIp, uint16_t remotePort);
+	uint32_t remoteIP() { return m_remoteIp; }
+	uint16_t remotePort() { return m_remotePort; }
+
+private:
+
+	int m_fd;
+	uint32_t m_bindAddress;
+	uint16_t m_localPort;
+	uint32_t m_remoteIp;
+	uint16_t m_remotePort;
+};
+
+/**
+ * @class PosixNetwork
+ * A fixed pool of UDP sockets: one for the TFTP port and one per transfer
+ */
+class PosixNetwork : public TftpNetwork {
+
+public:
+
+	/**
+	 * @param bindAddress IPv4 address every socket binds to.  Loopback by default.
+	 */
+	explicit PosixNetwork(uint32_t bindAddress = TFTP_LOOPBACK_ADDRESS);
+
+	TftpSocket* openSocket(uint16_t port);
+	void closeSocket(TftpSocket* socket);
+
+private:
+
+	PosixUdpSocket m_sockets[TFTP_MAX_SESSIONS + 1];
+	bool m_inUse[TFTP_MAX_SESSIONS + 1];
+};
+
+/**
+ * @class PosixClock
+ */
+class PosixClock : public TftpClock {
+
+public:
+
+	uint32_t millis();
+	uint32_t micros();
+};
+
+/**
+ * @class PosixStderrLog
+ */
+class PosixStderrLog : public TftpLog {
+
+public:
+
+	void write(const char* text);
+};
+
+#endif /* _TFTPPOSIX_H_ */
@@ -0,0 +1,261 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpSim.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <TftpSim.h>
+
+// ports handed out for port 0 start here (RFC 6335 dynamic range)
+const uint16_t SIM_EPHEMERAL_PORT_MIN = 49152;
+
+// a reordered packet is held back by this many one way delays
+const uint32_t SIM_REORDER_DELAYS = 1;
+
+static uint64_t socketKey (uint32_t address, uint16_t port) {
+
+	return (static_cast <uint64_t> (address) << 16) | port;
+}
+
+SimLink::SimLink (SimClock& clock, const SimImpairment& impairment, uint64_t seed) :
+		packetsSent(0), packetsDropped(0), packetsDuplicated(0), packetsReordered(0),
+		m_clock(clock), m_impairment(impairment), m_random(seed | 1), m_linkBusyUntil(0), m_lastArrival(0),
+		m_nextEphemeralPort(SIM_EPHEMERAL_PORT_MIN) {}
+
+// xorshift64* so every run with the same seed sees the same impairments
+double SimLink::uniform() {
+
+	m_random ^= m_random >> 12;
+	m_random ^= m_random << 25;
+	m_random ^= m_random >> 27;
+
+	return static_cast <double> ((m_random * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+void SimLink::send (const SimPacket& packet) {
+
+	if (m_tap) m_tap (packet);
+
+	++packetsSent;
+
+	// the packet occupies the link for its serialization time whether it survives or not
+	uint64_t departure = m_clock.now();
+
+	if (m_impairment.bitsPerSecond != 0) {
+
+		if (m_linkBusyUntil > departure) departure = m_linkBusyUntil;
+
+		departure += packet.data.size() * 8ULL * 1000000ULL / m_impairment.bitsPerSecond;
+
+		m_linkBusyUntil = departure;
+	}
+
+	if (uniform() < m_impairment.loss) {
+
+		++packetsDropped;
+
+		return;
+	}
+
+	uint64_t arrival = departure + m_impairment.delayMicros + static_cast <uint64_t> (uniform() * m_impairment.jitterMicros);
+
+	// jitter delays packets but the link is still first in first out
+	if (arrival < m_lastArrival) arrival = m_lastArrival;
+
+	m_lastArrival = arrival;
+
+	if (uniform() < m_impairment.reorder) {
+
+		++packetsReordered;
+
+		arrival += static_cast <uint64_t> (m_impairment.delayMicros) * SIM_REORDER_DELAYS + m_impairment.jitterMicros;
+	}
+
+	schedule (packet, arrival);
+
+	if (uniform() < m_impairment.duplicate) {
+
+		++packetsDuplicated;
+
+		schedule (packet, arrival + static_cast <uint64_t> (uniform() * m_impairment.jitterMicros) + 1);
+	}
+}
+
+void SimLink::schedule (const SimPacket& packet, uint64_t arrival) {
+
+	m_inFlight.insert (std::make_pair (arrival, packet));
+}
+
+size_t SimLink::deliver() {
+
+	size_t delivered = 0;
+
+	while (!m_inFlight.empty() && m_inFlight.begin()->first <= m_clock.now()) {
+
+		const SimPacket& packet = m_inFlight.begin()->second;
+
+		// nobody listening on that port means the packet is gone, just like UDP
+		std::map<uint64_t, SimSocket*>::iterator socket = m_sockets.find (socketKey (packet.destinationIp, packet.destinationPort));
+
+		if (socket != m_sockets.end()) {
+
+			socket->second->arrive (packet);
+
+			++delivered;
+		}
+
+		m_inFlight.erase (m_inFlight.begin());
+	}
+
+	return delivered;
+}
+
+uint64_t SimLink::nextArrival() const {
+
+	return m_inFlight.empty() ? UINT64_MAX : m_inFlight.begin()->first;
+}
+
+uint16_t SimLink::attach (SimSocket* socket, uint32_t address, uint16_t port) {
+
+	if (port == 0) {
+
+		// skip over ports that are still in use
+		do {
+			port = m_nextEphemeralPort++;
+
+			if (m_nextEphemeralPort == 0) m_nextEphemeralPort = SIM_EPHEMERAL_PORT_MIN;
+
+		} while (m_sockets.count (socketKey (address, port)) != 0);
+	}
+
+	else if (m_sockets.count (socketKey (address, port)) != 0) {
+
+		return 0;
+	}
+
+	m_sockets[socketKey (address, port)] = socket;
+
+	return port;
+}
+
+void SimLink::detach (uint32_t address, uint16_t port) {
+
+	m_sockets.erase (socketKey (address, port));
+}
+
+bool SimSocket::begin (uint16_t port) {
+
+	stop();
+
+	m_localPort = m_link->attach (this, m_address, port);
+
+	return m_localPort != 0;
+}
+
+void SimSocket::stop() {
+
+	if (m_localPort != 0) m_link->detach (m_address, m_localPort);
+
+	m_localPort = 0;
+
+	m_inbox.clear();
+}
+
+int SimSocket::receivePacket (uint8_t* buffer, size_t size) {
+
+	if (m_localPort == 0) return -1;
+
+	if (m_inbox.empty()) return 0;
+
+	const SimPacket& packet = m_inbox.front();
+
+	// like recvfrom() anything that does not fit is cut off
+	size_t length = (packet.data.size() < size) ? packet.data.size() : size;
+
+	memcpy (buffer, packet.data.data(), length);
+
+	m_remoteIp = packet.sourceIp;
+	m_remotePort = packet.sourcePort;
+
+	m_inbox.pop_front();
+
+	return static_cast <int> (length);
+}
+
+int SimSocket::sendPacket (const uint8_t* buffer, size_t length, uint32_t remoteIp, uint16_t remotePort) {
+
+	if (m_localPort == 0) return -1;
+
+	SimPacket packet;
+	packet.sourceIp = m_address;
+	packet.sourcePort = m_localPort;
+	packet.destinationIp = remoteIp;
+	packet.destinationPort = remotePort;
+	packet.data.assign (buffer, buffer + length);
+
+	m_link->send (packet);
+
+	return static_cast <int> (length);
+}
+
+SimNetwork::SimNetwork (SimLink& link, uint32_t address) {
+
+	for (uint8_t i = 0; i < TFTP_MAX_SESSIONS + 1; ++i) {
+
+		m_sockets[i].setLink (&link, address);
+		m_inUse[i] = false;
+	}
+}
+
+TftpSocket* SimNetwork::openSocket (uint16_t port) {
+
+	for (uint8_t i = 0; i < TFTP_MAX_SESSIONS + 1; ++i) {
+
+		if (!m_inUse[i]) {
+
+			if (!m_sockets[i].begin (port)) return NULL;
+
+			m_inUse[i] = true;
+
+			return &m_sockets[i];
+		}
+	}
+
+	return NULL;
+}
+
+void SimNetwork::closeSocket (TftpSocket* socket) {
+
+	for (uint8_t i = 0; i < TFTP_MAX_SESSIONS + 1; ++i) {
+
+		if (socket == &m_sockets[i]) {
+
+			m_sockets[i].stop();
+			m_inUse[i] = false;
+		}
+	}
+}
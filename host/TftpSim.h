@@ -0,0 +1,231 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpSim.h
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief In-process network simulator with a virtual clock
+ *
+ * Every packet sent through a SimLink is delivered (or not) according to a
+ * SimImpairment: a fixed one way delay plus random jitter that keeps packets in order, a link rate that
+ * serializes packets one after another, and random loss, duplication and
+ * reordering.  Time only moves when SimClock::advance() is called so runs are
+ * fast and, for a given seed, repeat exactly.
+ */
+
+#ifndef _TFTPSIM_H_
+#define _TFTPSIM_H_
+
+#include <TftpServer.h>
+#include <functional>
+#include <map>
+#include <vector>
+#include <deque>
+
+/**
+ * @class SimClock
+ * Virtual time in microseconds
+ */
+class SimClock : public TftpClock {
+
+public:
+
+	explicit SimClock(uint64_t start = 0) : m_now(start) {}
+
+	uint32_t millis() { return static_cast <uint32_t> (m_now / 1000); }
+	uint32_t micros() { return static_cast <uint32_t> (m_now); }
+
+	/**
+	 * @return Microseconds since the clock started, never wraps
+	 */
+	uint64_t now() const { return m_now; }
+
+	/**
+	 * @param microseconds How far to move time forward
+	 */
+	void advance(uint64_t microseconds) { m_now += microseconds; }
+
+private:
+
+	uint64_t m_now;
+};
+
+/**
+ * @struct SimImpairment
+ * What the link does to the packets going through it
+ */
+struct SimImpairment {
+	uint32_t delayMicros;    ///< fixed one way delay
+	uint32_t jitterMicros;   ///< random extra delay, uniform between 0 and this
+	uint32_t bitsPerSecond;  ///< link rate, 0 for unlimited
+	float loss;              ///< probability a packet is dropped
+	float duplicate;         ///< probability a packet is delivered twice
+	float reorder;           ///< probability a packet is held back behind later ones
+};
+
+/**
+ * @struct SimPacket
+ * A packet in flight
+ */
+struct SimPacket {
+	uint32_t sourceIp;
+	uint16_t sourcePort;
+	uint32_t destinationIp;
+	uint16_t destinationPort;
+	std::vector<uint8_t> data;
+};
+
+class SimSocket;
+
+/**
+ * @class SimLink
+ * Carries packets between the sockets attached to it
+ */
+class SimLink {
+
+public:
+
+	SimLink(SimClock& clock, const SimImpairment& impairment, uint64_t seed);
+
+	/**
+	 * Put a packet on the link.  The tap sees it before any impairment.
+	 */
+	void send(const SimPacket& packet);
+
+	/**
+	 * Hand every packet that has arrived by now to its socket.
+	 *
+	 * @return Number of packets delivered
+	 */
+	size_t deliver();
+
+	/**
+	 * @return Virtual time of the next arrival or UINT64_MAX if nothing is in flight
+	 */
+	uint64_t nextArrival() const;
+
+	/**
+	 * Give a socket a port and start delivering to it
+	 *
+	 * @param port Local port, 0 for the next free ephemeral one
+	 * @return The port or 0 if it is already taken
+	 */
+	uint16_t attach(SimSocket* socket, uint32_t address, uint16_t port);
+
+	/**
+	 * Stop delivering to a socket
+	 */
+	void detach(uint32_t address, uint16_t port);
+
+	/**
+	 * Watch every packet sent on the link
+	 */
+	void setTap(std::function<void (const SimPacket&)> tap) { m_tap = tap; }
+
+	SimClock& clock() { return m_clock; }
+
+	// what happened on the link
+	uint32_t packetsSent;
+	uint32_t packetsDropped;
+	uint32_t packetsDuplicated;
+	uint32_t packetsReordered;
+
+private:
+
+	double uniform();
+	void schedule(const SimPacket& packet, uint64_t arrival);
+
+	SimClock& m_clock;
+	SimImpairment m_impairment;
+	uint64_t m_random;
+	uint64_t m_linkBusyUntil;
+	uint64_t m_lastArrival;
+	uint16_t m_nextEphemeralPort;
+	std::multimap<uint64_t, SimPacket> m_inFlight;
+	std::map<uint64_t, SimSocket*> m_sockets;
+	std::function<void (const SimPacket&)> m_tap;
+};
+
+/**
+ * @class SimSocket
+ * A UDP socket on a SimLink
+ */
+class SimSocket : public TftpSocket {
+
+public:
+
+	SimSocket() : m_link(NULL), m_address(0), m_localPort(0), m_remoteIp(0), m_remotePort(0) {}
+	~SimSocket() { stop(); }
+
+	/**
+	 * @param link Link the socket sends and receives on
+	 * @param address IPv4 address of the host the socket lives on
+	 */
+	void setLink(SimLink* link, uint32_t address) { m_link = link; m_address = address; }
+
+	bool begin(uint16_t port);
+	void stop();
+	uint16_t localPort() { return m_localPort; }
+	int receivePacket(uint8_t* buffer, size_t size);
+	int sendPacket(const uint8_t* buffer, size_t length, uint32_t remoteIp, uint16_t remotePort);
+	uint32_t remoteIP() { return m_remoteIp; }
+	uint16_t remotePort() { return m_remotePort; }
+
+	/**
+	 * Called by the link when a packet arrives
+	 */
+	void arrive(const SimPacket& packet) { m_inbox.push_back(packet); }
+
+private:
+
+	SimLink* m_link;
+	uint32_t m_address;
+	uint16_t m_localPort;
+	uint32_t m_remoteIp;
+	uint16_t m_remotePort;
+	std::deque<SimPacket> m_inbox;
+};
+
+/**
+ * @class SimNetwork
+ * One host on a SimLink with a fixed pool of sockets
+ */
+class SimNetwork : public TftpNetwork {
+
+public:
+
+	SimNetwork(SimLink& link, uint32_t address);
+
+	TftpSocket* openSocket(uint16_t port);
+	void closeSocket(TftpSocket* socket);
+
+private:
+
+	SimSocket m_sockets[TFTP_MAX_SESSIONS + 1];
+	bool m_inUse[TFTP_MAX_SESSIONS + 1];
+};
+
+#endif /* _TFTPSIM_H_ */
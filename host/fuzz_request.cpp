@@ -0,0 +1,120 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name fuzz_request.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief libFuzzer target for the RRQ/WRQ parser
+ *
+ * Build with clang and -DTFTP_BUILD_FUZZER=ON, then run with a directory to keep the
+ * corpus in:
+ *
+ *   ./build/fuzz_request corpus/
+ *
+ * Other compilers get a stand-alone driver instead that runs each file named on the
+ * command line through the parser once, to replay a corpus or a crash under ASan.
+ */
+
+#include <TftpRequest.h>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// every string handed out has to lie inside the packet, terminator included
+static void checkText (const char* text, const uint8_t* data, size_t size) {
+
+	const uint8_t* start = reinterpret_cast <const uint8_t*> (text);
+
+	assert (start >= data && start < data + size);
+	assert (memchr (start, 0, data + size - start) != NULL);
+}
+
+extern "C" int LLVMFuzzerTestOneInput (const uint8_t* data, size_t size) {
+
+	TftpRequest request;
+
+	if (!request.parse (data, size)) return 0;
+
+	checkText (request.fileName(), data, size);
+	checkText (request.mode(), data, size);
+
+	request.modeIs ("octet");
+
+	assert (request.optionCount() <= TFTP_MAX_OPTIONS);
+
+	for (uint8_t i = 0; i < request.optionCount(); ++i) {
+
+		checkText (request.optionName (i), data, size);
+		checkText (request.optionValue (i), data, size);
+
+		uint32_t value;
+
+		TftpRequest::toNumber (request.optionValue (i), value);
+	}
+
+	return 0;
+}
+
+#ifdef TFTP_FUZZ_STANDALONE
+
+int main (int argc, char** argv) {
+
+	for (int i = 1; i < argc; ++i) {
+
+		FILE* file = fopen (argv[i], "rb");
+
+		if (file == NULL) {
+
+			perror (argv[i]);
+			return 1;
+		}
+
+		std::vector <uint8_t> data;
+		uint8_t buffer[4096];
+		size_t length;
+
+		while ((length = fread (buffer, 1, sizeof (buffer), file)) > 0) data.insert (data.end(), buffer, buffer + length);
+
+		fclose (file);
+
+		// an exactly sized copy so ASan sees any read past the end, the parser doesn't
+		// need a terminator after the packet
+		uint8_t* packet = new uint8_t [data.size()];
+
+		if (!data.empty()) memcpy (packet, data.data(), data.size());
+
+		LLVMFuzzerTestOneInput (packet, data.size());
+
+		delete [] packet;
+
+		printf ("%s: ok\n", argv[i]);
+	}
+
+	return 0;
+}
+
+#endif
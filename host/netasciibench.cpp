@@ -0,0 +1,260 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name netasciibench.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief Throughput of the streaming NETASCII codec
+ *
+ * Converts a text file held in RAM block by block, the way a transfer does, and
+ * reports MB/s for encoding (GET) and decoding (PUT) next to a byte-at-a-time loop
+ * doing the same conversion.  Nothing touches the network or the card, so this is
+ * the CPU cost of NETASCII alone.
+ *
+ * Usage: netasciibench [-s file size] [-b block size] [-l average line length]
+ */
+
+#include <TftpNetascii.h>
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+// enough passes over the file that a run takes a measurable time
+const int PASSES = 20;
+
+static double secondsSince (std::chrono::steady_clock::time_point start) {
+
+	return std::chrono::duration <double> (std::chrono::steady_clock::now() - start).count();
+}
+
+// text with \r\n line endings, like a log written with println()
+static std::vector<uint8_t> makeText (size_t size, size_t lineLength) {
+
+	std::vector<uint8_t> text;
+
+	srand (1);
+
+	while (text.size() < size) {
+
+		size_t length = 1 + rand() % (2 * lineLength);
+
+		for (size_t i = 0; i < length && text.size() < size; ++i) text.push_back ('a' + rand() % 26);
+
+		text.push_back ('\r');
+		text.push_back ('\n');
+	}
+
+	text.resize (size);
+
+	return text;
+}
+
+// encode the whole file into blocks, returns the bytes on the wire
+static size_t encodeFile (const std::vector<uint8_t>& file, size_t blockSize, std::vector<uint8_t>& block) {
+
+	NetasciiEncoder encoder;
+	size_t position = 0;
+	size_t total = 0;
+
+	while (position < file.size()) {
+
+		size_t consumed = 0;
+
+		total += encoder.encode (&file[position], file.size() - position, consumed, block.data(), blockSize);
+		position += consumed;
+	}
+
+	return total + encoder.finish (block.data(), blockSize);
+}
+
+static size_t encodeFileByByte (const std::vector<uint8_t>& file, size_t blockSize, std::vector<uint8_t>& block) {
+
+	size_t length = 0;
+	size_t total = 0;
+
+	for (size_t i = 0; i < file.size(); ++i) {
+
+		uint8_t c = file[i];
+
+		if (c == '\n' && (i == 0 || file[i - 1] != '\r')) block[length++] = '\r';
+
+		if (length == blockSize) { total += length; length = 0; }
+
+		block[length++] = c;
+
+		if (c == '\r' && (i + 1 == file.size() || file[i + 1] != '\n')) {
+
+			if (length == blockSize) { total += length; length = 0; }
+
+			block[length++] = '\0';
+		}
+
+		if (length == blockSize) { total += length; length = 0; }
+	}
+
+	return total + length;
+}
+
+// decode the wire data block by block, in place like a PUT
+static size_t decodeWire (const std::vector<uint8_t>& wire, size_t blockSize, std::vector<uint8_t>& block) {
+
+	NetasciiDecoder decoder;
+	size_t total = 0;
+
+	for (size_t position = 0; position < wire.size(); position += blockSize) {
+
+		size_t length = std::min (blockSize, wire.size() - position);
+
+		std::copy (&wire[position], &wire[position] + length, block.begin());
+
+		total += decoder.decode (block.data(), length);
+	}
+
+	return total;
+}
+
+static size_t decodeWireByByte (const std::vector<uint8_t>& wire, size_t blockSize, std::vector<uint8_t>& block) {
+
+	bool afterCarriageReturn = false;
+	size_t total = 0;
+
+	for (size_t position = 0; position < wire.size(); position += blockSize) {
+
+		size_t length = std::min (blockSize, wire.size() - position);
+		size_t out = 0;
+
+		for (size_t i = 0; i < length; ++i) {
+
+			uint8_t c = wire[position + i];
+
+			if (!(afterCarriageReturn && c == '\0')) block[out++] = c;
+
+			afterCarriageReturn = (c == '\r');
+		}
+
+		total += out;
+	}
+
+	return total;
+}
+
+static void report (const char* name, size_t bytes, double seconds, size_t check) {
+
+	printf ("%-18s %8.1f MB/s  (%zu bytes out)\n", name, PASSES * bytes / seconds / 1e6, check);
+}
+
+int main (int argc, char** argv) {
+
+	size_t fileSize = 4 * 1024 * 1024;
+	size_t blockSize = 512;
+	size_t lineLength = 40;
+
+	int option;
+
+	while ((option = getopt (argc, argv, "s:b:l:")) != -1) {
+
+		switch (option) {
+
+		case 's':
+			fileSize = strtoul (optarg, NULL, 0);
+			break;
+
+		case 'b':
+			blockSize = strtoul (optarg, NULL, 0);
+			break;
+
+		case 'l':
+			lineLength = strtoul (optarg, NULL, 0);
+			break;
+
+		default:
+			fprintf (stderr, "usage: %s [-s file size] [-b block size] [-l average line length]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (blockSize < 2 || lineLength == 0) {
+
+		fprintf (stderr, "block size must be at least 2 and line length at least 1\n");
+		return 1;
+	}
+
+	std::vector<uint8_t> file = makeText (fileSize, lineLength);
+	std::vector<uint8_t> block (blockSize);
+
+	// the wire form of the file to decode
+	std::vector<uint8_t> wire;
+
+	{
+		NetasciiEncoder encoder;
+		size_t position = 0;
+
+		while (position < file.size()) {
+
+			size_t consumed = 0;
+			size_t length = encoder.encode (&file[position], file.size() - position, consumed, block.data(), blockSize);
+
+			wire.insert (wire.end(), block.begin(), block.begin() + length);
+			position += consumed;
+		}
+
+		size_t length = encoder.finish (block.data(), blockSize);
+
+		wire.insert (wire.end(), block.begin(), block.begin() + length);
+	}
+
+	printf ("%zu byte file, %zu byte blocks, lines of about %zu characters\n\n", fileSize, blockSize, lineLength);
+
+	size_t out = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < PASSES; ++i) out = encodeFile (file, blockSize, block);
+
+	report ("encode", file.size(), secondsSince (start), out);
+
+	start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < PASSES; ++i) out = encodeFileByByte (file, blockSize, block);
+
+	report ("encode by byte", file.size(), secondsSince (start), out);
+
+	start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < PASSES; ++i) out = decodeWire (wire, blockSize, block);
+
+	report ("decode", wire.size(), secondsSince (start), out);
+
+	start = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < PASSES; ++i) out = decodeWireByByte (wire, blockSize, block);
+
+	report ("decode by byte", wire.size(), secondsSince (start), out);
+
+	return 0;
+}
@@ -0,0 +1,234 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name test_netascii.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief Unit tests for the streaming NETASCII codec
+ *
+ * Every input is converted whole by a byte-at-a-time reference and in chunks by the
+ * codec, split at every possible point and with output buffers from 1 byte up, so
+ * sequences cut in two by a block boundary are covered.  Run with ctest.
+ */
+
+#include <TftpNetascii.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+static int failures = 0;
+
+static void check (bool ok, const char* test, const std::string& detail) {
+
+	if (ok) return;
+
+	failures++;
+
+	printf ("FAIL %s: %s\n", test, detail.c_str());
+}
+
+// readable form of binary data for failure messages
+static std::string show (const std::string& data) {
+
+	std::string text;
+
+	for (size_t i = 0; i < data.size(); ++i) {
+
+		char c = data[i];
+
+		if (c == '\r') text += "\\r";
+		else if (c == '\n') text += "\\n";
+		else if (c == '\0') text += "\\0";
+		else text += c;
+	}
+
+	return text;
+}
+
+// one byte at a time, straight from the rules
+static std::string referenceEncode (const std::string& file) {
+
+	std::string out;
+
+	for (size_t i = 0; i < file.size(); ++i) {
+
+		if (file[i] == '\r' && i + 1 < file.size() && file[i + 1] == '\n') {
+
+			out += "\r\n";
+			i++;
+		}
+
+		else if (file[i] == '\r') out += std::string ("\r\0", 2);
+		else if (file[i] == '\n') out += "\r\n";
+		else out += file[i];
+	}
+
+	return out;
+}
+
+static std::string referenceDecode (const std::string& wire) {
+
+	std::string out;
+
+	for (size_t i = 0; i < wire.size(); ++i) {
+
+		if (wire[i] == '\0' && i > 0 && wire[i - 1] == '\r') continue;
+
+		out += wire[i];
+	}
+
+	return out;
+}
+
+// file data fed in two pieces, output taken in pieces of outputSize bytes
+static std::string encode (const std::string& file, size_t split, size_t outputSize) {
+
+	NetasciiEncoder encoder;
+	std::string out;
+	uint8_t buffer[64];
+
+	const uint8_t* data = reinterpret_cast <const uint8_t*> (file.data());
+	size_t pieces[2][2] = { { 0, split }, { split, file.size() } };
+
+	for (int p = 0; p < 2; ++p) {
+
+		size_t position = pieces[p][0];
+
+		while (position < pieces[p][1]) {
+
+			size_t consumed = 0;
+			size_t length = encoder.encode (&data[position], pieces[p][1] - position, consumed, buffer, outputSize);
+
+			out.append (reinterpret_cast <char*> (buffer), length);
+			position += consumed;
+
+			// no progress with room to spare would loop forever
+			if (consumed == 0 && length == 0) return out + "<stuck>";
+		}
+	}
+
+	for (;;) {
+
+		size_t length = encoder.finish (buffer, outputSize);
+
+		if (length == 0) break;
+
+		out.append (reinterpret_cast <char*> (buffer), length);
+	}
+
+	return out;
+}
+
+// NETASCII data decoded in two chunks
+static std::string decode (const std::string& wire, size_t split) {
+
+	NetasciiDecoder decoder;
+	std::string first = wire.substr (0, split);
+	std::string second = wire.substr (split);
+
+	size_t length = decoder.decode (reinterpret_cast <uint8_t*> (&first[0]), first.size());
+	std::string out = first.substr (0, length);
+
+	length = decoder.decode (reinterpret_cast <uint8_t*> (&second[0]), second.size());
+
+	return out + second.substr (0, length);
+}
+
+// every split point and output size against the reference, both directions
+static void roundTrip (const char* test, const std::string& file) {
+
+	std::string expected = referenceEncode (file);
+
+	for (size_t split = 0; split <= file.size(); ++split) {
+
+		for (size_t outputSize = 1; outputSize <= 9; ++outputSize) {
+
+			std::string encoded = encode (file, split, outputSize);
+
+			check (encoded == expected, test, "encode " + show (file) + " gave " + show (encoded) + ", expected " + show (expected) +
+					" (split " + std::to_string (split) + ", output " + std::to_string (outputSize) + ")");
+		}
+	}
+
+	// files are stored with \r\n line endings so a bare \n comes back as \r\n
+	std::string stored = referenceDecode (expected);
+
+	for (size_t split = 0; split <= expected.size(); ++split) {
+
+		std::string decoded = decode (expected, split);
+
+		check (decoded == stored, test, "decode " + show (expected) + " gave " + show (decoded) + ", expected " + show (stored) +
+				" (split " + std::to_string (split) + ")");
+	}
+}
+
+int main() {
+
+	// the cases that used to go wrong at block boundaries
+	roundTrip ("crlf", "line one\r\nline two\r\n");
+	roundTrip ("crlf-split", std::string (7, 'a') + "\r\n" + std::string (7, 'b'));
+	roundTrip ("bare-lf", "a\nb\n\n");
+	roundTrip ("lone-cr", "a\rb");
+	roundTrip ("cr-cr-lf", "\r\r\n\r");
+	roundTrip ("cr-nul", std::string ("a\r\0b", 4));
+	roundTrip ("trailing-cr", "end of file\r");
+	roundTrip ("only-cr", "\r");
+	roundTrip ("empty", "");
+
+	// a lone \r goes out as \r\0 and comes back as a lone \r
+	check (encode ("a\rb", 1, 8) == std::string ("a\r\0b", 4), "lone-cr", "encoded as " + show (encode ("a\rb", 1, 8)));
+	check (decode (std::string ("a\r\0b", 4), 2) == "a\rb", "cr-nul", "decoded as " + show (decode (std::string ("a\r\0b", 4), 2)));
+
+	// a \r at the very end of the file still gets its \0
+	check (encode ("x\r", 2, 8) == std::string ("x\r\0", 3), "trailing-cr", "encoded as " + show (encode ("x\r", 2, 8)));
+
+	// a \0 that isn't after a \r is data
+	check (decode (std::string ("a\0\r\0\0", 5), 3) == std::string ("a\0\r\0", 4), "nul", "stray \\0 dropped");
+
+	// random text heavy on line endings
+	srand (1);
+
+	for (int run = 0; run < 200; ++run) {
+
+		static const char alphabet[] = { 'a', 'b', '\r', '\n', '\0' };
+		std::string file;
+
+		for (int i = rand() % 24; i > 0; --i) file += alphabet[rand() % sizeof (alphabet)];
+
+		roundTrip ("random", file);
+	}
+
+	if (failures > 0) {
+
+		printf ("%d failures\n", failures);
+
+		return 1;
+	}
+
+	printf ("all NETASCII tests passed\n");
+
+	return 0;
+}
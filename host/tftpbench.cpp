@@ -0,0 +1,519 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name tftpbench.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief Transfer benchmark over simulated lossy links
+ *
+ * Runs the server against a scripted RRQ client through a SimLink for a set of
+ * link scenarios (RTT, jitter, loss, duplication, reordering) and option
+ * combinations.  Everything runs on virtual time so a run takes milliseconds
+ * of real time and a given seed always gives the same result.
+ *
+ * For every scenario it reports:
+ *   goodput      file bytes delivered per second of virtual time over all runs
+ *   retx         DATA packets sent by the server that were retransmissions, in
+ *                percent of the blocks in the file
+ *   p50/p95/p99  completion time percentiles over the runs
+ *
+ * Usage: tftpbench [-n runs] [-s file size] [-f scenario name filter]
+ */
+
+#include <TftpPosix.h>
+#include <TftpSim.h>
+#include <algorithm>
+#include <stdlib.h>
+#include <unistd.h>
+
+const uint32_t SERVER_ADDRESS = 0x0A000001; // 10.0.0.1
+const uint32_t CLIENT_ADDRESS = 0x0A000002; // 10.0.0.2
+const uint16_t SERVER_PORT = 69;
+
+const char* BENCH_FILE_NAME = "bench.bin";
+
+// client retransmission timer, like most TFTP clients
+const uint64_t CLIENT_TIMEOUT = 1000000; // microseconds
+const uint8_t CLIENT_MAX_RETRIES = 8;
+
+// give up on a run that takes longer than this much virtual time
+const uint64_t RUN_DEADLINE = 600000000; // microseconds
+
+// the server only sees milliseconds so there is no point stepping finer than that
+const uint64_t IDLE_STEP = 1000; // microseconds
+
+/**
+ * @struct scenario_t
+ * A link and the options the client asks for
+ */
+struct scenario_t {
+	const char* name;
+	SimImpairment link;
+	uint16_t blockSize;
+	uint16_t windowSize;
+};
+
+const scenario_t SCENARIOS[] = {
+	//  name            delay  jitter   rate      loss   dup    reorder  blksize window
+	{ "lan",          {   500,    200, 100000000, 0.00f, 0.00f, 0.00f },  512, 1 },
+	{ "lan",          {   500,    200, 100000000, 0.00f, 0.00f, 0.00f }, 1468, 8 },
+	{ "wifi",         {  2500,   2000,  20000000, 0.00f, 0.00f, 0.00f },  512, 1 },
+	{ "wifi",         {  2500,   2000,  20000000, 0.00f, 0.00f, 0.00f }, 1468, 8 },
+	{ "wifi-loss1",   {  2500,   2000,  20000000, 0.01f, 0.00f, 0.00f },  512, 1 },
+	{ "wifi-loss1",   {  2500,   2000,  20000000, 0.01f, 0.00f, 0.00f }, 1468, 8 },
+	{ "wifi-loss3",   {  2500,   4000,  20000000, 0.03f, 0.01f, 0.01f },  512, 1 },
+	{ "wifi-loss3",   {  2500,   4000,  20000000, 0.03f, 0.01f, 0.01f }, 1468, 8 },
+	{ "wifi-loss5",   {  5000,   8000,  10000000, 0.05f, 0.01f, 0.03f },  512, 1 },
+	{ "wifi-loss5",   {  5000,   8000,  10000000, 0.05f, 0.01f, 0.03f }, 1468, 8 },
+	{ "wifi-reorder", {  2500,   4000,  20000000, 0.01f, 0.02f, 0.05f }, 1468, 8 },
+};
+
+// the byte at a given offset of the benchmark file
+static uint8_t fileByte (uint32_t offset) {
+
+	return static_cast <uint8_t> ((offset * 2654435761U) >> 24);
+}
+
+/**
+ * @class BenchClient
+ * A scripted RRQ client with RFC 2348 and RFC 7440 support
+ */
+class BenchClient {
+
+public:
+
+	BenchClient (SimLink& link) : m_clock(link.clock()) {
+
+		m_socket.setLink (&link, CLIENT_ADDRESS);
+		m_socket.begin (0);
+	}
+
+	// ask for the file
+	void start (const char* fileName, uint32_t fileSize, uint16_t blockSize, uint16_t windowSize) {
+
+		m_fileSize = fileSize;
+		m_blockSize = 512;
+		m_windowSize = 1;
+		m_expectedBlock = 1;
+		m_blocksSinceAck = 0;
+		m_gapAcked = false;
+		m_bytesReceived = 0;
+		m_serverPort = 0;
+		m_retries = 0;
+		m_startTime = m_clock.now();
+		finished = false;
+		failed = false;
+
+		std::vector<uint8_t> request;
+		appendWord (request, 1);
+		appendText (request, fileName);
+		appendText (request, "octet");
+
+		char value[8];
+
+		if (blockSize != 512) {
+
+			snprintf (value, sizeof (value), "%u", blockSize);
+			appendText (request, "blksize");
+			appendText (request, value);
+		}
+
+		if (windowSize != 1) {
+
+			snprintf (value, sizeof (value), "%u", windowSize);
+			appendText (request, "windowsize");
+			appendText (request, value);
+		}
+
+		send (request, SERVER_PORT);
+	}
+
+	// handle whatever arrived and the retransmission timer
+	void step() {
+
+		uint8_t packet [65536];
+		int length;
+
+		while ((length = m_socket.receivePacket (packet, sizeof (packet))) > 0) {
+
+			if (m_serverPort == 0) m_serverPort = m_socket.remotePort();
+
+			// stray packet from another transfer ID
+			if (m_socket.remotePort() != m_serverPort || length < 4) continue;
+
+			uint16_t opCode = (packet[0] << 8) | packet[1];
+			uint16_t block = (packet[2] << 8) | packet[3];
+
+			if (opCode == 6 && m_expectedBlock == 1 && !finished) {
+
+				readOptionAck (packet, length);
+
+				m_activityTime = m_clock.now();
+				sendAck (0);
+			}
+
+			else if (opCode == 3) {
+
+				receiveData (block, &packet[4], length - 4);
+			}
+
+			else if (opCode == 5) {
+
+				failed = true;
+			}
+		}
+
+		// nothing from the server for a while, say the last thing again
+		if (!finished && !failed && m_clock.now() - m_activityTime >= CLIENT_TIMEOUT) {
+
+			if (++m_retries > CLIENT_MAX_RETRIES) {
+
+				failed = true;
+
+				return;
+			}
+
+			m_activityTime = m_clock.now();
+			m_socket.sendPacket (m_lastPacket.data(), m_lastPacket.size(), SERVER_ADDRESS, m_lastPort);
+		}
+	}
+
+	bool finished;
+	bool failed;
+
+	uint64_t completionTime() const { return m_finishTime - m_startTime; }
+
+	// blocks in the file, including the empty one when the size is a multiple of the block size
+	uint32_t blocks() const { return m_fileSize / m_blockSize + 1; }
+
+private:
+
+	void receiveData (uint16_t block, const uint8_t* data, size_t length) {
+
+		// the next block in order
+		if (block == m_expectedBlock && !finished) {
+
+			for (size_t i = 0; i < length; ++i) {
+
+				if (data[i] != fileByte (m_bytesReceived + i)) failed = true;
+			}
+
+			m_bytesReceived += length;
+			m_expectedBlock++;
+			m_blocksSinceAck++;
+			m_gapAcked = false;
+			m_retries = 0;
+			m_activityTime = m_clock.now();
+
+			if (length < m_blockSize) {
+
+				finished = true;
+				m_finishTime = m_clock.now();
+
+				if (m_bytesReceived != m_fileSize) failed = true;
+
+				sendAck (block);
+			}
+
+			else if (m_blocksSinceAck >= m_windowSize) {
+
+				sendAck (block);
+			}
+		}
+
+		// a block went missing, tell the server where to start again (RFC 7440)
+		else if (static_cast <uint16_t> (block - m_expectedBlock) < 0x8000 && !finished) {
+
+			if (!m_gapAcked) sendAck (m_expectedBlock - 1);
+
+			m_gapAcked = true;
+		}
+
+		// the server did not hear the ACK for the last block, or the final ACK got lost
+		else if (block == static_cast <uint16_t> (m_expectedBlock - 1)) {
+
+			sendAck (block);
+		}
+	}
+
+	void readOptionAck (const uint8_t* packet, int length) {
+
+		std::string name;
+		std::string value;
+		bool readingName = true;
+
+		for (int i = 2; i < length; ++i) {
+
+			if (packet[i] != 0) {
+
+				(readingName ? name : value) += static_cast <char> (packet[i]);
+			}
+
+			else if (readingName) {
+
+				readingName = false;
+			}
+
+			else {
+
+				if (name == "blksize") m_blockSize = atoi (value.c_str());
+				if (name == "windowsize") m_windowSize = atoi (value.c_str());
+
+				name.clear();
+				value.clear();
+				readingName = true;
+			}
+		}
+	}
+
+	void sendAck (uint16_t block) {
+
+		std::vector<uint8_t> ack;
+		appendWord (ack, 4);
+		appendWord (ack, block);
+
+		m_blocksSinceAck = 0;
+
+		send (ack, m_serverPort);
+	}
+
+	void send (const std::vector<uint8_t>& packet, uint16_t port) {
+
+		m_lastPacket = packet;
+		m_lastPort = port;
+		m_activityTime = m_clock.now();
+
+		m_socket.sendPacket (packet.data(), packet.size(), SERVER_ADDRESS, port);
+	}
+
+	static void appendWord (std::vector<uint8_t>& packet, uint16_t word) {
+
+		packet.push_back (word >> 8);
+		packet.push_back (word & 0xFF);
+	}
+
+	static void appendText (std::vector<uint8_t>& packet, const char* text) {
+
+		packet.insert (packet.end(), text, text + strlen (text) + 1);
+	}
+
+	SimClock& m_clock;
+	SimSocket m_socket;
+
+	uint32_t m_fileSize;
+	uint16_t m_blockSize;
+	uint16_t m_windowSize;
+	uint16_t m_expectedBlock;
+	uint16_t m_blocksSinceAck;
+	bool m_gapAcked;
+	uint32_t m_bytesReceived;
+	uint16_t m_serverPort;
+	uint8_t m_retries;
+
+	std::vector<uint8_t> m_lastPacket;
+	uint16_t m_lastPort;
+
+	uint64_t m_startTime;
+	uint64_t m_finishTime;
+	uint64_t m_activityTime;
+};
+
+/**
+ * @struct result_t
+ * How one run went
+ */
+struct result_t {
+	bool failed;
+	uint64_t completionTime;
+	uint32_t blocks;
+	uint32_t dataPackets;
+};
+
+// one transfer from start to finish
+static result_t runTransfer (SdFat& sd, TftpLog& log, const scenario_t& scenario, uint32_t fileSize, uint64_t seed) {
+
+	SimClock clock (1000000);
+	SimLink link (clock, scenario.link, seed);
+	SimNetwork serverNetwork (link, SERVER_ADDRESS);
+
+	result_t result = {};
+
+	// count every DATA packet the server puts on the wire
+	link.setTap ([&result] (const SimPacket& packet) {
+
+		if (packet.sourceIp == SERVER_ADDRESS && packet.data.size() >= 4 && packet.data[1] == 3) result.dataPackets++;
+	});
+
+	TftpServer server;
+	server.begin (&sd, serverNetwork, clock, log, false, SERVER_PORT);
+
+	BenchClient client (link);
+	client.start (BENCH_FILE_NAME, fileSize, scenario.blockSize, scenario.windowSize);
+
+	uint64_t deadline = clock.now() + RUN_DEADLINE;
+
+	for (;;) {
+
+		link.deliver();
+
+		bool serverBusy = server.poll();
+
+		client.step();
+
+		// done once the client has the file (or gave up) and the server has let go
+		if ((client.finished || client.failed) && !serverBusy) break;
+
+		if (clock.now() > deadline) {
+
+			client.failed = true;
+			break;
+		}
+
+		// jump ahead to the next thing that happens
+		uint64_t next = link.nextArrival();
+
+		if (next > clock.now()) {
+
+			clock.advance (std::min (next - clock.now(), IDLE_STEP));
+		}
+	}
+
+	server.stop();
+
+	result.failed = client.failed || !client.finished;
+	result.completionTime = client.completionTime();
+	result.blocks = client.blocks();
+
+	return result;
+}
+
+// value below which a fraction of the sorted samples fall
+static double percentile (const std::vector<uint64_t>& sorted, double fraction) {
+
+	if (sorted.empty()) return 0;
+
+	size_t index = static_cast <size_t> (fraction * (sorted.size() - 1) + 0.5);
+
+	return sorted[index] / 1000.0;
+}
+
+int main (int argc, char** argv) {
+
+	uint32_t runs = 50;
+	uint32_t fileSize = 256 * 1024;
+	const char* filter = "";
+
+	int option;
+
+	while ((option = getopt (argc, argv, "n:s:f:")) != -1) {
+
+		switch (option) {
+
+		case 'n':
+			runs = atoi (optarg);
+			break;
+
+		case 's':
+			fileSize = atoi (optarg);
+			break;
+
+		case 'f':
+			filter = optarg;
+			break;
+
+		default:
+			fprintf (stderr, "usage: %s [-n runs] [-s file size] [-f scenario name filter]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// the file to serve lives in a scratch directory
+	char directory[] = "/tmp/tftpbenchXXXXXX";
+
+	if (mkdtemp (directory) == NULL || chdir (directory) != 0) {
+
+		perror ("scratch directory");
+		return 1;
+	}
+
+	FILE* file = fopen (BENCH_FILE_NAME, "wb");
+
+	for (uint32_t i = 0; i < fileSize; ++i) fputc (fileByte (i), file);
+
+	fclose (file);
+
+	SdFat sd;
+	PosixStderrLog log;
+
+	printf ("%u runs of a %u byte RRQ per scenario\n\n", runs, fileSize);
+	printf ("%-13s %7s %6s %6s %5s %11s %7s %9s %9s %9s %9s\n", "scenario", "blksize", "window",
+			"loss%", "fail", "goodput", "retx%", "p50 ms", "p95 ms", "p99 ms", "max ms");
+
+	for (size_t s = 0; s < sizeof (SCENARIOS) / sizeof (SCENARIOS[0]); ++s) {
+
+		const scenario_t& scenario = SCENARIOS[s];
+
+		if (strstr (scenario.name, filter) == NULL) continue;
+
+		std::vector<uint64_t> times;
+		uint64_t totalTime = 0;
+		uint64_t totalBlocks = 0;
+		uint64_t totalDataPackets = 0;
+		uint32_t failures = 0;
+
+		for (uint32_t run = 0; run < runs; ++run) {
+
+			result_t result = runTransfer (sd, log, scenario, fileSize, (s + 1) * 1000003ULL + run);
+
+			if (result.failed) {
+
+				failures++;
+				continue;
+			}
+
+			times.push_back (result.completionTime);
+			totalTime += result.completionTime;
+			totalBlocks += result.blocks;
+			totalDataPackets += result.dataPackets;
+		}
+
+		std::sort (times.begin(), times.end());
+
+		double goodput = totalTime ? static_cast <double> (fileSize) * times.size() / (totalTime / 1000000.0) / 1024.0 : 0;
+		double retransmits = totalBlocks ? 100.0 * (totalDataPackets - totalBlocks) / totalBlocks : 0;
+
+		printf ("%-13s %7u %6u %6.1f %5u %6.0f KB/s %7.2f %9.1f %9.1f %9.1f %9.1f\n", scenario.name,
+				scenario.blockSize, scenario.windowSize, scenario.link.loss * 100.0, failures, goodput, retransmits,
+				percentile (times, 0.50), percentile (times, 0.95), percentile (times, 0.99),
+				percentile (times, 1.0));
+	}
+
+	unlink (BENCH_FILE_NAME);
+	chdir ("/");
+	rmdir (directory);
+
+	return 0;
+}
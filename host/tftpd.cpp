@@ -0,0 +1,236 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name tftpd.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief Serve a directory from a Linux host with the same code that runs on the device
+ *
+ * Usage: tftpd [-p port] [-a address] [-d] [-w durability] [-c cache size] [-i] [-s budget] [-r rate] [-g] [-x files] [-t records] [directory]
+ *
+ *   -p  TFTP port, 6969 by default so no privileges are needed
+ *   -a  IPv4 address to listen on, 127.0.0.1 by default
+ *   -d  print debug information on stderr
+ *   -w  write durability: 0 every block, 1 every 64 KB, 2 on close
+ *   -c  bytes of RAM for the file cache, 0 (off) by default
+ *   -i  remember the size on the wire of files sent in NETASCII mode
+ *   -s  microseconds per step() call, 0 (poll() instead) by default
+ *   -r  pace DATA packets at this many bytes per second, 0 (off) by default
+ *   -g  serve the generated file stats.txt and throw away anything written to null/
+ *   -x  keep an index of up to this many files of the directory in RAM, 0 (off) by default
+ *   -t  trace the last this many packets, fetch them as trace.bin for tftpreplay
+ */
+
+#include <TftpPosix.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+/**
+ * Server statistics as text, taken when the read request arrives
+ */
+class StatsProvider : public TftpFileProvider {
+
+public:
+
+	explicit StatsProvider (const TftpServer& server) : m_server(server) {}
+
+	virtual bool openRead (TftpVirtualFile& file) {
+
+		const TftpServer::serverStats_t& stats = m_server.getStats();
+
+		char text[512];
+
+		snprintf (text, sizeof (text),
+			"reads %lu\nwrites %lu\ncompleted %lu\naborted %lu\nrejected %lu\nqueued %lu\ncache hits %lu\n"
+			"bytes sent %lu\nbytes received %lu\nretransmissions %lu\ntimeouts %lu\n",
+			static_cast <unsigned long> (stats.reads), static_cast <unsigned long> (stats.writes),
+			static_cast <unsigned long> (stats.completed), static_cast <unsigned long> (stats.aborted),
+			static_cast <unsigned long> (stats.rejected), static_cast <unsigned long> (stats.queued),
+			static_cast <unsigned long> (stats.cacheHits), static_cast <unsigned long> (stats.bytesSent),
+			static_cast <unsigned long> (stats.bytesReceived), static_cast <unsigned long> (stats.retransmissions),
+			static_cast <unsigned long> (stats.timeouts));
+
+		std::string* snapshot = new std::string (text);
+
+		file.context = snapshot;
+		file.size = snapshot->size();
+
+		return true;
+	}
+
+	virtual int read (TftpVirtualFile& file, uint32_t position, uint8_t* buffer, size_t count) {
+
+		const std::string* snapshot = static_cast <const std::string*> (file.context);
+
+		if (position >= snapshot->size()) return 0;
+
+		return static_cast <int> (snapshot->copy (reinterpret_cast <char*> (buffer), count, position));
+	}
+
+	virtual void close (TftpVirtualFile& file, bool /* completed */) {
+
+		delete static_cast <std::string*> (file.context);
+	}
+
+private:
+
+	const TftpServer& m_server;
+};
+
+/**
+ * Accepts any write and keeps nothing, for measuring the network without the disk
+ */
+class NullProvider : public TftpFileProvider {
+
+public:
+
+	virtual bool openWrite (TftpVirtualFile& /* file */) { return true; }
+
+	virtual bool write (TftpVirtualFile& /* file */, uint32_t /* position */, const uint8_t* /* data */, size_t /* length */) { return true; }
+};
+
+int main (int argc, char** argv) {
+
+	uint16_t port = 6969;
+	uint32_t address = TFTP_LOOPBACK_ADDRESS;
+	bool debug = false;
+	int durability = TftpServer::SYNC_EVERY_BLOCK;
+	size_t cacheSize = 0;
+	bool netasciiIndex = false;
+	uint32_t budget = 0;
+	uint32_t paceRate = 0;
+	bool generated = false;
+	uint16_t directoryFiles = 0;
+	size_t traceRecords = 0;
+
+	int option;
+
+	while ((option = getopt (argc, argv, "p:a:dw:c:is:r:gx:t:")) != -1) {
+
+		switch (option) {
+
+		case 'p':
+			port = static_cast <uint16_t> (atoi (optarg));
+			break;
+
+		case 'a':
+			address = ntohl (inet_addr (optarg));
+			break;
+
+		case 'd':
+			debug = true;
+			break;
+
+		case 'w':
+			durability = atoi (optarg);
+			break;
+
+		case 'c':
+			cacheSize = strtoul (optarg, NULL, 10);
+			break;
+
+		case 'i':
+			netasciiIndex = true;
+			break;
+
+		case 's':
+			budget = strtoul (optarg, NULL, 10);
+			break;
+
+		case 'r':
+			paceRate = strtoul (optarg, NULL, 10);
+			break;
+
+		case 'g':
+			generated = true;
+			break;
+
+		case 'x':
+			directoryFiles = static_cast <uint16_t> (atoi (optarg));
+			break;
+
+		case 't':
+			traceRecords = strtoul (optarg, NULL, 10);
+			break;
+
+		default:
+			fprintf (stderr, "usage: %s [-p port] [-a address] [-d] [-w durability] [-c cache size] [-i] [-s budget] [-r rate] [-g] [-x files] [-t records] [directory]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// files are served from the working directory
+	if (optind < argc && chdir (argv[optind]) != 0) {
+
+		perror (argv[optind]);
+		return 1;
+	}
+
+	static SdFat sd;
+	static PosixNetwork network (address);
+	static TftpServer tftpServer;
+
+	tftpServer.setDirectoryIndex (directoryFiles);
+
+	if (!tftpServer.begin (&sd, network, tftpDefaultClock(), tftpDefaultLog(), debug, port, cacheSize)) {
+
+		fprintf (stderr, "unable to open port %u\n", port);
+		return 1;
+	}
+
+	tftpServer.setWriteDurability (static_cast <TftpServer::durability_t> (durability), 65536);
+	tftpServer.setNetasciiIndex (netasciiIndex);
+	tftpServer.setPacing (paceRate, 4 * (TFTP_MAX_BLOCK_SIZE + 4));
+
+	static StatsProvider statsProvider (tftpServer);
+	static NullProvider nullProvider;
+
+	static std::vector <uint8_t> traceStorage (traceRecords * TFTP_TRACE_RECORD_SIZE);
+	static TftpRingBufferProvider trace (traceStorage.data(), traceStorage.size());
+
+	if (traceRecords > 0) {
+
+		tftpServer.setTrace (&trace);
+		tftpServer.addProvider ("trace.bin", &trace);
+	}
+
+	if (generated) {
+
+		tftpServer.addProvider ("stats.txt", &statsProvider);
+		tftpServer.addProvider ("null/", &nullProvider, true);
+	}
+
+	for (;;) {
+
+		bool busy = (budget > 0) ? tftpServer.step (budget) : tftpServer.poll();
+
+		// nap while there is nothing to do
+		if (!busy) usleep (1000);
+	}
+}
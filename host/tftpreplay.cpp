@@ -0,0 +1,442 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name tftpreplay.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief Play a packet trace captured with setTrace() back into the server
+ *
+ * Every packet the traced server received is sent to a fresh server again, from the
+ * same peer and at the same time relative to the start of the trace, over a perfect
+ * simulated link on virtual time.  The packets the server sends back are traced too
+ * and compared with the original ones, peer by peer, so a field problem can be
+ * reproduced exactly and a fix checked against real traffic.  The clients are played
+ * back as they were: they don't react to what the new server does differently.
+ *
+ * Requests ask for files in the directory given (the working directory by default),
+ * which should hold files of the same size as on the device.  DATA packets of uploads
+ * carry zeros.
+ *
+ * Usage: tftpreplay [-d] [-v] trace.bin [directory]
+ *
+ *   -d  print the debug output of the server
+ *   -v  list every packet of both runs
+ */
+
+#include <TftpPosix.h>
+#include <TftpSim.h>
+#include <TftpTrace.h>
+#include <map>
+#include <stdlib.h>
+#include <unistd.h>
+
+const uint32_t SERVER_ADDRESS = 0x0A000001; // 10.0.0.1
+const uint16_t SERVER_PORT = 69;
+
+// how often the server is polled while nothing arrives
+const uint64_t IDLE_STEP = 1000; // microseconds
+
+// how long the server gets to finish after the last packet of the trace
+const uint64_t DRAIN_TIME = 60000000; // microseconds
+
+const uint8_t OPCODE_RRQ = 1;
+const uint8_t OPCODE_WRQ = 2;
+const uint8_t OPCODE_ERROR = 5;
+
+/**
+ * @struct event_t
+ * A packet of a trace on a time line that doesn't wrap
+ */
+struct event_t {
+	uint64_t time;                       ///< microseconds since the first record
+	tftpTraceRecord_t record;
+	std::vector<uint8_t> packet;         ///< rebuilt packet, received packets only
+};
+
+/**
+ * @struct peer_t
+ * The far end of traced transfers
+ */
+struct peer_t {
+	SimSocket socket;
+	uint16_t serverPort;                 ///< transfer ID of the server in the replay
+};
+
+static uint64_t peerKey (uint32_t address, uint16_t port) {
+
+	return (static_cast <uint64_t> (address) << 16) | port;
+}
+
+static const char* opCodeName (uint8_t opCode) {
+
+	static const char* names[] = { "?", "RRQ", "WRQ", "DATA", "ACK", "ERROR", "OACK" };
+
+	return opCode < 7 ? names[opCode] : "?";
+}
+
+// turn trace records back into packets
+static void decodeTrace (const uint8_t* bytes, size_t length, std::vector<event_t>& events) {
+
+	uint64_t time = 0;
+	uint32_t lastTime = 0;
+
+	for (size_t offset = 0; offset + TFTP_TRACE_RECORD_SIZE <= length; ) {
+
+		event_t event;
+
+		TftpTrace::decode (&bytes[offset], event.record);
+
+		offset += TFTP_TRACE_RECORD_SIZE;
+
+		// the start of a request whose first record was overwritten
+		if (event.record.flags & TFTP_TRACE_CONTINUATION) continue;
+
+		// micros() wraps every 71 minutes
+		if (!events.empty()) time += event.record.time - lastTime;
+
+		lastTime = event.record.time;
+		event.time = time;
+
+		const tftpTraceRecord_t& record = event.record;
+
+		if (!(record.flags & TFTP_TRACE_SENT)) {
+
+			event.packet.push_back (0);
+			event.packet.push_back (record.opCode);
+
+			// requests come back from their continuation records
+			if (record.opCode == OPCODE_RRQ || record.opCode == OPCODE_WRQ) {
+
+				while (offset + TFTP_TRACE_RECORD_SIZE <= length && (bytes[offset + TFTP_TRACE_RECORD_SIZE - 1] & TFTP_TRACE_CONTINUATION)) {
+
+					event.packet.insert (event.packet.end(), &bytes[offset], &bytes[offset + TFTP_TRACE_RECORD_SIZE - 1]);
+
+					offset += TFTP_TRACE_RECORD_SIZE;
+				}
+
+				// the last piece was padded
+				if (event.packet.size() > record.size) event.packet.resize (record.size);
+			}
+
+			// the rest only need their block number and size, ERRORs need a message
+			else {
+
+				event.packet.push_back (static_cast <uint8_t> (record.block >> 8));
+				event.packet.push_back (static_cast <uint8_t> (record.block));
+				event.packet.resize (record.size > 4 ? record.size : (record.opCode == OPCODE_ERROR ? 5 : 4), 0);
+			}
+		}
+
+		events.push_back (event);
+	}
+}
+
+static void printRecord (const char* run, const event_t& event) {
+
+	const tftpTraceRecord_t& record = event.record;
+
+	// requests and OACKs have no block number, only text
+	char block[8] = "-";
+
+	if (record.opCode >= 3 && record.opCode <= 5) snprintf (block, sizeof (block), "%u", record.block);
+
+	printf ("%s %10.3f ms  %s %u.%u.%u.%u:%u  %-5s %5s  %u bytes\n", run, event.time / 1000.0,
+		(record.flags & TFTP_TRACE_SENT) ? "->" : "<-",
+		record.peerAddress >> 24, (record.peerAddress >> 16) & 0xFF, (record.peerAddress >> 8) & 0xFF, record.peerAddress & 0xFF,
+		record.peerPort, opCodeName (record.opCode), block, record.size);
+}
+
+// what the server sent to one peer
+static std::vector<const event_t*> sentTo (const std::vector<event_t>& events, uint64_t key) {
+
+	std::vector<const event_t*> sent;
+
+	for (size_t i = 0; i < events.size(); ++i) {
+
+		const tftpTraceRecord_t& record = events[i].record;
+
+		if ((record.flags & TFTP_TRACE_SENT) && peerKey (record.peerAddress, record.peerPort) == key) sent.push_back (&events[i]);
+	}
+
+	return sent;
+}
+
+// DATA packets for blocks that were already sent
+static uint32_t retransmissions (const std::vector<const event_t*>& sent) {
+
+	uint32_t count = 0;
+	bool started = false;
+	uint16_t highest = 0;
+
+	for (size_t i = 0; i < sent.size(); ++i) {
+
+		const tftpTraceRecord_t& record = sent[i]->record;
+
+		if (record.opCode != 3) continue;
+
+		if (started && static_cast <uint16_t> (highest - record.block) < 0x8000) count++;
+		else highest = record.block;
+
+		started = true;
+	}
+
+	return count;
+}
+
+int main (int argc, char** argv) {
+
+	bool debug = false;
+	bool verbose = false;
+
+	int option;
+
+	while ((option = getopt (argc, argv, "dv")) != -1) {
+
+		switch (option) {
+
+		case 'd':
+			debug = true;
+			break;
+
+		case 'v':
+			verbose = true;
+			break;
+
+		default:
+			fprintf (stderr, "usage: %s [-d] [-v] trace.bin [directory]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc) {
+
+		fprintf (stderr, "usage: %s [-d] [-v] trace.bin [directory]\n", argv[0]);
+		return 1;
+	}
+
+	// the original trace
+	FILE* file = fopen (argv[optind], "rb");
+
+	if (file == NULL) {
+
+		perror (argv[optind]);
+		return 1;
+	}
+
+	std::vector<uint8_t> bytes;
+	uint8_t buffer[4096];
+	size_t length;
+
+	while ((length = fread (buffer, 1, sizeof (buffer), file)) > 0) bytes.insert (bytes.end(), buffer, buffer + length);
+
+	fclose (file);
+
+	std::vector<event_t> original;
+
+	decodeTrace (bytes.data(), bytes.size(), original);
+
+	if (original.empty()) {
+
+		fprintf (stderr, "%s: no packets in the trace\n", argv[optind]);
+		return 1;
+	}
+
+	// files are served from the working directory
+	if (optind + 1 < argc && chdir (argv[optind + 1]) != 0) {
+
+		perror (argv[optind + 1]);
+		return 1;
+	}
+
+	// a server on a perfect link, tracing into a buffer big enough for everything
+	SimClock clock (1000000);
+	SimImpairment perfect = {};
+	SimLink link (clock, perfect, 1);
+	SimNetwork serverNetwork (link, SERVER_ADDRESS);
+
+	std::vector<uint8_t> traceStorage ((4 * bytes.size() / TFTP_TRACE_RECORD_SIZE + 4096) * TFTP_TRACE_RECORD_SIZE);
+	TftpRingBufferProvider trace (traceStorage.data(), traceStorage.size());
+
+	static SdFat sd;
+	TftpServer server;
+
+	if (!server.begin (&sd, serverNetwork, clock, tftpDefaultLog(), debug, SERVER_PORT)) {
+
+		fprintf (stderr, "unable to start the server\n");
+		return 1;
+	}
+
+	server.setTrace (&trace);
+
+	// one socket for every client in the trace, at its own address and port
+	std::map<uint64_t, peer_t*> peers;
+
+	for (size_t i = 0; i < original.size(); ++i) {
+
+		const tftpTraceRecord_t& record = original[i].record;
+		uint64_t key = peerKey (record.peerAddress, record.peerPort);
+
+		if (peers.count (key) == 0) {
+
+			peer_t* peer = new peer_t();
+
+			peer->socket.setLink (&link, record.peerAddress);
+			peer->socket.begin (record.peerPort);
+			peer->serverPort = 0;
+
+			peers[key] = peer;
+		}
+	}
+
+	uint64_t start = clock.now();
+	uint32_t skipped = 0;
+
+	// run the server until a point in virtual time
+	auto runUntil = [&] (uint64_t until, bool stopWhenIdle) {
+
+		for (;;) {
+
+			link.deliver();
+
+			bool busy = server.poll();
+
+			// the clients only learn where the server answers from
+			for (std::map<uint64_t, peer_t*>::iterator it = peers.begin(); it != peers.end(); ++it) {
+
+				while (it->second->socket.receivePacket (buffer, sizeof (buffer)) > 0) {
+
+					it->second->serverPort = it->second->socket.remotePort();
+				}
+			}
+
+			if (stopWhenIdle && !busy && link.nextArrival() == UINT64_MAX) break;
+
+			if (clock.now() >= until) break;
+
+			uint64_t next = std::min (std::min (link.nextArrival(), until), clock.now() + IDLE_STEP);
+
+			if (next > clock.now()) clock.advance (next - clock.now());
+		}
+	};
+
+	// send what the clients sent, when they sent it
+	for (size_t i = 0; i < original.size(); ++i) {
+
+		const event_t& event = original[i];
+
+		if (event.record.flags & TFTP_TRACE_SENT) continue;
+
+		runUntil (start + event.time, false);
+
+		peer_t* peer = peers[peerKey (event.record.peerAddress, event.record.peerPort)];
+
+		bool request = event.record.opCode == OPCODE_RRQ || event.record.opCode == OPCODE_WRQ;
+
+		// the server never answered this client in the replay
+		if (!request && peer->serverPort == 0) {
+
+			skipped++;
+			continue;
+		}
+
+		peer->socket.sendPacket (event.packet.data(), event.packet.size(), SERVER_ADDRESS, request ? SERVER_PORT : peer->serverPort);
+	}
+
+	runUntil (clock.now() + DRAIN_TIME, true);
+
+	// what the replayed server sent
+	TftpVirtualFile traceFile = {};
+
+	trace.openRead (traceFile);
+
+	std::vector<uint8_t> replayBytes (traceFile.size);
+
+	trace.read (traceFile, 0, replayBytes.data(), replayBytes.size());
+
+	std::vector<event_t> replay;
+
+	decodeTrace (replayBytes.data(), replayBytes.size(), replay);
+
+	if (verbose) {
+
+		for (size_t i = 0; i < original.size(); ++i) printRecord ("trace ", original[i]);
+		for (size_t i = 0; i < replay.size(); ++i) printRecord ("replay", replay[i]);
+	}
+
+	// peer by peer comparison of what the server sent
+	int differences = 0;
+
+	for (std::map<uint64_t, peer_t*>::iterator it = peers.begin(); it != peers.end(); ++it) {
+
+		std::vector<const event_t*> before = sentTo (original, it->first);
+		std::vector<const event_t*> after = sentTo (replay, it->first);
+
+		uint32_t address = static_cast <uint32_t> (it->first >> 16);
+
+		printf ("%u.%u.%u.%u:%u  sent %zu / %zu  retransmitted %u / %u", address >> 24, (address >> 16) & 0xFF,
+			(address >> 8) & 0xFF, address & 0xFF, static_cast <unsigned> (it->first & 0xFFFF),
+			before.size(), after.size(), retransmissions (before), retransmissions (after));
+
+		size_t same = 0;
+
+		while (same < before.size() && same < after.size() && before[same]->record.opCode == after[same]->record.opCode &&
+				before[same]->record.block == after[same]->record.block && before[same]->record.size == after[same]->record.size) {
+
+			same++;
+		}
+
+		if (same == before.size() && same == after.size()) {
+
+			printf ("  same packets\n");
+		}
+
+		else {
+
+			differences++;
+
+			printf ("  differs from packet %zu\n", same + 1);
+
+			if (same < before.size()) printRecord ("  trace ", *before[same]);
+			if (same < after.size()) printRecord ("  replay", *after[same]);
+		}
+	}
+
+	const TftpServer::serverStats_t& stats = server.getStats();
+
+	printf ("replay: %lu timeouts, %lu retransmissions, %lu completed, %lu aborted",
+		static_cast <unsigned long> (stats.timeouts), static_cast <unsigned long> (stats.retransmissions),
+		static_cast <unsigned long> (stats.completed), static_cast <unsigned long> (stats.aborted));
+
+	if (skipped > 0) printf (", %u client packets had nowhere to go", skipped);
+
+	printf ("\n");
+
+	server.stop();
+
+	for (std::map<uint64_t, peer_t*>::iterator it = peers.begin(); it != peers.end(); ++it) delete it->second;
+
+	return differences == 0 ? 0 : 2;
+}
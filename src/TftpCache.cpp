@@ -0,0 +1,249 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpCache.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <TftpCache.h>
+#include <string.h>
+#include <new>
+
+bool TftpFileCache::begin (size_t budget) {
+
+	end();
+
+	if (budget == 0) return true;
+
+	m_arena = new (std::nothrow) uint8_t [budget];
+
+	if (m_arena == NULL) return false;
+
+	m_budget = budget;
+
+	return true;
+}
+
+void TftpFileCache::end() {
+
+	delete [] m_arena;
+
+	m_arena = NULL;
+	m_budget = 0;
+
+	for (int i = 0; i < TFTP_CACHE_ENTRIES; ++i) {
+		m_entries[i].used = false;
+	}
+}
+
+int TftpFileCache::find (const char* name, uint32_t size, uint32_t modified) {
+
+	for (int i = 0; i < TFTP_CACHE_ENTRIES; ++i) {
+
+		entry_t& entry = m_entries[i];
+
+		if (entry.used && !entry.stale && entry.filled == entry.size && strcmp (entry.name, name) == 0) {
+
+			// the file changed since it was cached
+			if (entry.size != size || entry.modified != modified) {
+
+				if (entry.users == 0) remove (i);
+				else entry.stale = true;
+
+				return -1;
+			}
+
+			entry.lastUsed = ++m_useCounter;
+			entry.users++;
+
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+int TftpFileCache::reserve (const char* name, uint32_t size, uint32_t modified) {
+
+	// a file bigger than half the cache would push everything else out
+	if (m_arena == NULL || size > m_budget / 2 || strlen (name) >= TFTP_CACHE_NAME_SIZE) return -1;
+
+	// someone else is already filling in this file
+	for (int i = 0; i < TFTP_CACHE_ENTRIES; ++i) {
+
+		if (m_entries[i].used && !m_entries[i].stale && strcmp (m_entries[i].name, name) == 0) return -1;
+	}
+
+	int slot = -1;
+
+	// drop the least recently used files that nobody is reading until the new one fits
+	for (;;) {
+
+		int leastRecent = -1;
+
+		slot = -1;
+
+		for (int i = 0; i < TFTP_CACHE_ENTRIES; ++i) {
+
+			const entry_t& entry = m_entries[i];
+
+			if (!entry.used) {
+
+				if (slot < 0) slot = i;
+			}
+
+			else if (entry.users == 0 && (leastRecent < 0 || entry.lastUsed < m_entries[leastRecent].lastUsed)) {
+
+				leastRecent = i;
+			}
+		}
+
+		if (slot >= 0 && usedBytes() + size <= m_budget) break;
+
+		// everything left is in use
+		if (leastRecent < 0) return -1;
+
+		remove (leastRecent);
+	}
+
+	entry_t& entry = m_entries[slot];
+
+	// the new file goes right after the others
+	entry.offset = usedBytes();
+
+	strcpy (entry.name, name);
+	entry.used = true;
+	entry.stale = false;
+	entry.size = size;
+	entry.modified = modified;
+	entry.filled = 0;
+	entry.lastUsed = ++m_useCounter;
+	entry.users = 1;
+
+	return slot;
+}
+
+void TftpFileCache::fill (int slot, uint32_t position, const uint8_t* data, size_t length) {
+
+	entry_t& entry = m_entries[slot];
+
+	// only data that picks up where the entry left off (re-reads after a rewind are skipped)
+	if (position > entry.filled || position + length <= entry.filled) return;
+
+	size_t skip = entry.filled - position;
+	size_t count = length - skip;
+
+	// the file grew since it was opened
+	if (entry.filled + count > entry.size) {
+
+		entry.stale = true;
+
+		return;
+	}
+
+	memcpy (&m_arena [entry.offset + entry.filled], &data[skip], count);
+
+	entry.filled += count;
+}
+
+bool TftpFileCache::complete (int slot) const {
+
+	const entry_t& entry = m_entries[slot];
+
+	return !entry.stale && entry.filled == entry.size;
+}
+
+int TftpFileCache::read (int slot, uint32_t position, uint8_t* buffer, size_t count) const {
+
+	const entry_t& entry = m_entries[slot];
+
+	if (position >= entry.size) return 0;
+
+	if (count > entry.size - position) count = entry.size - position;
+
+	memcpy (buffer, &m_arena [entry.offset + position], count);
+
+	return static_cast <int> (count);
+}
+
+void TftpFileCache::release (int slot) {
+
+	entry_t& entry = m_entries[slot];
+
+	if (entry.users > 0) entry.users--;
+
+	// an entry that never got complete is no good to anyone
+	if (entry.users == 0 && (entry.stale || entry.filled != entry.size)) {
+
+		remove (slot);
+	}
+}
+
+void TftpFileCache::invalidate (const char* name) {
+
+	for (int i = 0; i < TFTP_CACHE_ENTRIES; ++i) {
+
+		entry_t& entry = m_entries[i];
+
+		if (entry.used && strcmp (entry.name, name) == 0) {
+
+			if (entry.users == 0) remove (i);
+			else entry.stale = true;
+		}
+	}
+}
+
+void TftpFileCache::remove (int slot) {
+
+	entry_t& removed = m_entries[slot];
+
+	size_t end = usedBytes();
+
+	// close the gap
+	memmove (&m_arena [removed.offset], &m_arena [removed.offset + removed.size], end - removed.offset - removed.size);
+
+	for (int i = 0; i < TFTP_CACHE_ENTRIES; ++i) {
+
+		if (m_entries[i].used && m_entries[i].offset > removed.offset) {
+
+			m_entries[i].offset -= removed.size;
+		}
+	}
+
+	removed.used = false;
+}
+
+size_t TftpFileCache::usedBytes() const {
+
+	size_t used = 0;
+
+	for (int i = 0; i < TFTP_CACHE_ENTRIES; ++i) {
+
+		if (m_entries[i].used) used += m_entries[i].size;
+	}
+
+	return used;
+}
@@ -0,0 +1,184 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpCache.h
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief RAM cache for small files that are read over and over
+ *
+ * The cache is one block of RAM allocated when the server starts, so its size is
+ * fixed and known up front.  Files are packed into it back to back and tracked in a
+ * small table of TFTP_CACHE_ENTRIES slots.  When a new file needs room the least
+ * recently used files that are not being sent are dropped and the rest are moved
+ * down to close the gap.
+ *
+ * A file is copied into the cache while it is sent the first time, so there is never
+ * a long read up front, and only becomes usable once every byte has been seen.
+ * Entries remember the size and modification time of the file and are only used
+ * while both still match.
+ */
+
+#ifndef _TFTPCACHE_H_
+#define _TFTPCACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Number of files the cache keeps track of.
+ */
+#ifndef TFTP_CACHE_ENTRIES
+#define TFTP_CACHE_ENTRIES 8
+#endif
+
+/**
+ * Longest file name (including the terminating null) that can be cached.
+ */
+#ifndef TFTP_CACHE_NAME_SIZE
+#define TFTP_CACHE_NAME_SIZE 64
+#endif
+
+/**
+ * @class TftpFileCache
+ */
+class TftpFileCache {
+
+public:
+
+	TftpFileCache() : m_arena(NULL), m_budget(0), m_useCounter(0) {}
+	~TftpFileCache() { end(); }
+
+	/**
+	 * Allocate the cache.
+	 *
+	 * @param budget Bytes of RAM for file contents.  0 turns the cache off.
+	 * @return True if the memory could be allocated (or none was asked for).
+	 */
+	bool begin(size_t budget);
+
+	/**
+	 * Drop everything and free the memory
+	 */
+	void end();
+
+	/**
+	 * Look for a complete copy of a file.  The entry stays put until release().
+	 *
+	 * @param name File name
+	 * @param size Current size of the file
+	 * @param modified Current modification time of the file
+	 * @return The slot of the entry or -1 if there is no valid copy.
+	 */
+	int find(const char* name, uint32_t size, uint32_t modified);
+
+	/**
+	 * Make room for a file that is about to be read.  The entry stays put until
+	 * release() and becomes usable once fill() has seen every byte.
+	 *
+	 * @param name File name
+	 * @param size Size of the file
+	 * @param modified Modification time of the file
+	 * @return The slot of the new entry or -1 if the file can't be cached.
+	 */
+	int reserve(const char* name, uint32_t size, uint32_t modified);
+
+	/**
+	 * Copy file data that was just read into an entry.  Only data that continues
+	 * where the entry left off is used.
+	 *
+	 * @param slot Slot returned by reserve()
+	 * @param position File position of the data
+	 * @param data The data
+	 * @param length Number of bytes
+	 */
+	void fill(int slot, uint32_t position, const uint8_t* data, size_t length);
+
+	/**
+	 * @param slot Slot returned by find() or reserve()
+	 * @return True once the entry holds the whole file
+	 */
+	bool complete(int slot) const;
+
+	/**
+	 * Read from a complete entry
+	 *
+	 * @param slot Slot returned by find()
+	 * @param position File position to read from
+	 * @param buffer Where the data goes
+	 * @param count Number of bytes wanted
+	 * @return Number of bytes read, 0 at the end of the file
+	 */
+	int read(int slot, uint32_t position, uint8_t* buffer, size_t count) const;
+
+	/**
+	 * Done with an entry.  Entries that never got complete are dropped.
+	 *
+	 * @param slot Slot returned by find() or reserve()
+	 */
+	void release(int slot);
+
+	/**
+	 * Forget any copy of a file, for example after it was written
+	 *
+	 * @param name File name
+	 */
+	void invalidate(const char* name);
+
+private:
+
+	/**
+	 * @struct entry_t
+	 * One cached file
+	 */
+	struct entry_t {
+		bool used;                           ///< slot holds a file
+		bool stale;                          ///< drop the entry as soon as nobody uses it
+		char name[TFTP_CACHE_NAME_SIZE];     ///< file name
+		uint32_t size;                       ///< file size and bytes reserved in the arena
+		uint32_t modified;                   ///< modification time of the file
+		uint32_t offset;                     ///< where the data starts in the arena
+		uint32_t filled;                     ///< bytes copied in so far
+		uint32_t lastUsed;                   ///< value of m_useCounter when last used
+		uint8_t users;                       ///< transfers reading the entry
+	};
+
+	/**
+	 * Remove an entry and move the data behind it down so the free space stays at the end
+	 */
+	void remove(int slot);
+
+	/**
+	 * @return Bytes of the arena in use
+	 */
+	size_t usedBytes() const;
+
+	entry_t m_entries[TFTP_CACHE_ENTRIES] = {};
+	uint8_t* m_arena;
+	size_t m_budget;
+	uint32_t m_useCounter;
+};
+
+#endif /* _TFTPCACHE_H_ */
@@ -0,0 +1,174 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpDirectoryIndex.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <TftpDirectoryIndex.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <new>
+
+bool TftpDirectoryIndex::begin (uint16_t maxFiles) {
+
+	end();
+
+	if (maxFiles == 0) return true;
+
+	// keep the table at most 80% full so probe runs stay short
+	uint32_t capacity = 16;
+
+	while (capacity < maxFiles + maxFiles / 4u) capacity *= 2;
+
+	if (capacity > 0x8000) return false;
+
+	m_slots = new (std::nothrow) uint16_t [2 * capacity];
+
+	if (m_slots == NULL) return false;
+
+	memset (m_slots, 0, 2 * capacity * sizeof (uint16_t));
+
+	m_capacity = static_cast <uint16_t> (capacity);
+
+	if (!m_root.open ("/", O_READ)) {
+
+		end();
+
+		return false;
+	}
+
+	File entry;
+	char name[TFTP_DIRECTORY_NAME_SIZE];
+
+	// one pass over the directory
+	while (entry.openNext (&m_root, O_READ)) {
+
+		bool indexed = entry.isDir() || (m_count < maxFiles && entry.getName (name, sizeof (name)) &&
+				insert (name, entry.dirIndex()));
+
+		entry.close();
+
+		// a file the index doesn't know about would be reported missing
+		if (!indexed) {
+
+			end();
+
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void TftpDirectoryIndex::end() {
+
+	delete [] m_slots;
+
+	m_slots = NULL;
+	m_capacity = 0;
+	m_count = 0;
+
+	if (m_root.isOpen()) m_root.close();
+}
+
+TftpDirectoryIndex::lookup_t TftpDirectoryIndex::open (const char* name, File& file, int oflag) {
+
+	if (!covers (name)) return LOOKUP_UNKNOWN;
+
+	uint32_t h = hash (name);
+	uint16_t tag = static_cast <uint16_t> (h >> 16) | 1;
+	uint16_t mask = m_capacity - 1;
+
+	char entryName[TFTP_DIRECTORY_NAME_SIZE];
+
+	// every slot with a matching tag until the first free one
+	for (uint16_t i = h & mask; m_slots[2 * i] != 0; i = (i + 1) & mask) {
+
+		if (m_slots[2 * i] != tag) continue;
+
+		// the entry may since have been deleted or reused by another file
+		if (file.open (&m_root, m_slots[2 * i + 1], oflag)) {
+
+			if (file.getName (entryName, sizeof (entryName)) && strcasecmp (entryName, name) == 0) {
+
+				return LOOKUP_FOUND;
+			}
+
+			file.close();
+		}
+	}
+
+	return LOOKUP_NOT_FOUND;
+}
+
+void TftpDirectoryIndex::add (const char* name, File& file) {
+
+	if (!covers (name)) return;
+
+	// a file the index can't hold makes every "not found" answer wrong
+	if (!insert (name, file.dirIndex())) end();
+}
+
+bool TftpDirectoryIndex::insert (const char* name, uint16_t dirIndex) {
+
+	if (m_count + 1u > m_capacity - m_capacity / 5u) return false;
+
+	uint32_t h = hash (name);
+	uint16_t mask = m_capacity - 1;
+
+	uint16_t i = h & mask;
+
+	while (m_slots[2 * i] != 0) i = (i + 1) & mask;
+
+	// tags are odd so a used slot is never 0
+	m_slots[2 * i] = static_cast <uint16_t> (h >> 16) | 1;
+	m_slots[2 * i + 1] = dirIndex;
+
+	m_count++;
+
+	return true;
+}
+
+// FNV-1a
+uint32_t TftpDirectoryIndex::hash (const char* name) {
+
+	uint32_t h = 2166136261u;
+
+	for (; *name != '\0'; ++name) {
+
+		h ^= static_cast <uint8_t> (tolower (static_cast <unsigned char> (*name)));
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+bool TftpDirectoryIndex::covers (const char* name) const {
+
+	return m_slots != NULL && strchr (name, '/') == NULL && strlen (name) < TFTP_DIRECTORY_NAME_SIZE;
+}
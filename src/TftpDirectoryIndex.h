@@ -0,0 +1,140 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpDirectoryIndex.h
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief In-memory index of the files in the root directory of the card
+ *
+ * Finding a file on a FAT volume means scanning its directory entry by entry, and the
+ * server used to do that twice per request (exists() and open()).  With thousands of
+ * files each scan takes long enough for clients to repeat their request.
+ *
+ * The index is built once by reading the directory and keeps a short hash of every
+ * name next to its directory entry number in an open addressing hash table, 4 bytes
+ * per slot.  A lookup opens the file straight from its entry and checks the name, so
+ * hash collisions cost one extra entry read.  A name with no matching hash is known
+ * not to exist without touching the card.
+ *
+ * Only the root directory is indexed.  Names with a path, and every name while the
+ * index is off or overflowed, get LOOKUP_UNKNOWN and go the usual way.
+ */
+
+#ifndef _TFTPDIRECTORYINDEX_H_
+#define _TFTPDIRECTORYINDEX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <SdFat.h>
+
+/**
+ * Longest file name (including the terminating null) the index can check
+ */
+#ifndef TFTP_DIRECTORY_NAME_SIZE
+#define TFTP_DIRECTORY_NAME_SIZE 256
+#endif
+
+/**
+ * @class TftpDirectoryIndex
+ */
+class TftpDirectoryIndex {
+
+public:
+
+	/**
+	 * Answer of open()
+	 */
+	typedef enum {
+		LOOKUP_UNKNOWN,      ///< the index can't tell, look the file up on the card
+		LOOKUP_FOUND,        ///< the file is open
+		LOOKUP_NOT_FOUND     ///< there is no such file
+	} lookup_t;
+
+	TftpDirectoryIndex() : m_slots(NULL), m_capacity(0), m_count(0) {}
+	~TftpDirectoryIndex() { end(); }
+
+	/**
+	 * Read the root directory and build the index
+	 *
+	 * @param maxFiles Most files the index has room for, 0 turns it off
+	 * @return True if every file fit, false if the index is off
+	 */
+	bool begin(uint16_t maxFiles);
+
+	/**
+	 * Turn the index off and free its memory
+	 */
+	void end();
+
+	/**
+	 * Open a file through the index
+	 *
+	 * @param name File name
+	 * @param file Opened on LOOKUP_FOUND
+	 * @param oflag How to open it
+	 * @return Whether the file was found, not found or the card has to be asked
+	 */
+	lookup_t open(const char* name, File& file, int oflag);
+
+	/**
+	 * Add a file that was just created
+	 *
+	 * @param name File name
+	 * @param file The open file
+	 */
+	void add(const char* name, File& file);
+
+	/**
+	 * @return Number of files in the index
+	 */
+	uint16_t count() const { return m_count; }
+
+private:
+
+	/**
+	 * Put a name in the table
+	 *
+	 * @return False if the table is too full to take it
+	 */
+	bool insert(const char* name, uint16_t dirIndex);
+
+	/**
+	 * @return A hash of the name that ignores case like FAT does
+	 */
+	static uint32_t hash(const char* name);
+
+	/**
+	 * @return True if the index can be used for the name
+	 */
+	bool covers(const char* name) const;
+
+	File m_root;
+	uint16_t* m_slots;                   ///< hash tag and directory entry of each slot, tag 0 is free
+	uint16_t m_capacity;                 ///< slots in the table, a power of two
+	uint16_t m_count;
+};
+
+#endif /* _TFTPDIRECTORYINDEX_H_ */
@@ -0,0 +1,189 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpNetascii.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <TftpNetascii.h>
+#include <string.h>
+
+// every byte of a 32 bit word set to the same value
+const uint32_t ONES  = 0x01010101UL;
+const uint32_t HIGHS = 0x80808080UL;
+const uint32_t CRS   = 0x0D0D0D0DUL;
+const uint32_t LFS   = 0x0A0A0A0AUL;
+
+// non-zero if any byte of the word is zero
+static inline uint32_t hasZeroByte (uint32_t word) {
+
+	return (word - ONES) & ~word & HIGHS;
+}
+
+// index of the first \r or \n, or length if there isn't one
+static size_t findLineEnding (const uint8_t* data, size_t length) {
+
+	size_t i = 0;
+
+	// skip ahead a word at a time while none of the 4 bytes is \r or \n
+	for (; i + 4 <= length; i += 4) {
+
+		uint32_t word;
+
+		memcpy (&word, &data[i], 4);
+
+		if (hasZeroByte (word ^ CRS) | hasZeroByte (word ^ LFS)) break;
+	}
+
+	// then find the exact byte
+	for (; i < length; ++i) {
+
+		if (data[i] == '\r' || data[i] == '\n') break;
+	}
+
+	return i;
+}
+
+// file data to NETASCII
+size_t NetasciiEncoder::encode (const uint8_t* input, size_t inputLength, size_t& consumed,
+		uint8_t* output, size_t outputSize) {
+
+	size_t in = 0;
+	size_t out = 0;
+
+	while (out < outputSize) {
+
+		// finish a \r\n that was split by the end of the last output
+		if (m_state == PENDING_LF) {
+
+			output[out++] = '\n';
+			m_state = NORMAL;
+
+			continue;
+		}
+
+		if (in == inputLength) break;
+
+		// \r\n is already NETASCII, a lone \r becomes \r\0
+		if (m_state == AFTER_CR) {
+
+			if (input[in] == '\n') {
+
+				output[out++] = input[in++];
+			}
+
+			else {
+
+				output[out++] = '\0';
+			}
+
+			m_state = NORMAL;
+
+			continue;
+		}
+
+		// copy everything up to the next line ending in one go
+		size_t limit = inputLength - in;
+
+		if (outputSize - out < limit) limit = outputSize - out;
+
+		size_t run = findLineEnding (&input[in], limit);
+
+		memcpy (&output[out], &input[in], run);
+
+		in += run;
+		out += run;
+
+		// ran out of input or output
+		if (run == limit) continue;
+
+		// \r or \n both go out as \r first and the next byte is decided later
+		m_state = (input[in++] == '\n') ? PENDING_LF : AFTER_CR;
+
+		output[out++] = '\r';
+	}
+
+	consumed = in;
+
+	return out;
+}
+
+// end of the file
+size_t NetasciiEncoder::finish (uint8_t* output, size_t outputSize) {
+
+	size_t out = 0;
+
+	if (outputSize > 0 && m_state != NORMAL) {
+
+		// a \r at the very end of the file is a lone \r
+		output[out++] = (m_state == PENDING_LF) ? '\n' : '\0';
+
+		m_state = NORMAL;
+	}
+
+	return out;
+}
+
+// NETASCII to file data
+size_t NetasciiDecoder::decode (uint8_t* data, size_t length) {
+
+	size_t in = 0;
+	size_t out = 0;
+
+	// drop the \0 of a \r\0 that was split between two chunks
+	if (m_afterCarriageReturn && length > 0 && data[0] == '\0') in = 1;
+
+	m_afterCarriageReturn = false;
+
+	while (in < length) {
+
+		// everything up to and including the next \r stays as it is
+		const uint8_t* carriageReturn = static_cast <const uint8_t*> (memchr (&data[in], '\r', length - in));
+
+		size_t run = (carriageReturn != NULL) ? (carriageReturn - &data[in]) + 1 : length - in;
+
+		if (out != in) memmove (&data[out], &data[in], run);
+
+		in += run;
+		out += run;
+
+		if (carriageReturn != NULL) {
+
+			// the \0 after a \r only marks it as a lone \r
+			if (in == length) {
+
+				m_afterCarriageReturn = true;
+			}
+
+			else if (data[in] == '\0') {
+
+				in++;
+			}
+		}
+	}
+
+	return out;
+}
@@ -0,0 +1,153 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpNetascii.h
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief Streaming NETASCII conversion for TFTP transfers
+ *
+ * NETASCII (RFC 764) sends every line ending as \r\n and every carriage return that
+ * is not part of a line ending as \r\0.  Files on the SD card are read and written
+ * with the same convention Particle's println() uses (\r\n), with bare \n accepted
+ * on the way out as well.
+ *
+ * Both classes work on whole chunks of data and keep the state of a \r\n or \r\0
+ * sequence that is split between two chunks, so blocks can be read from and written
+ * to the card in bulk no matter where the packet boundaries fall.  Runs of ordinary
+ * characters are found a 32 bit word at a time and copied with memcpy().
+ */
+
+#ifndef _TFTPNETASCII_H_
+#define _TFTPNETASCII_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @class NetasciiEncoder
+ *
+ * Converts file data to NETASCII:
+ *  - \n becomes \r\n
+ *  - \r\n stays \r\n
+ *  - a lone \r becomes \r\0
+ */
+class NetasciiEncoder {
+
+public:
+
+	NetasciiEncoder() : m_state(NORMAL) {}
+
+	/**
+	 * Start a new conversion
+	 */
+	void reset() { m_state = NORMAL; }
+
+	/**
+	 * Convert as much of the input as fits in the output.
+	 *
+	 * Output never needs more input than it has room for, so reading outputSize bytes
+	 * of the file is always enough to fill the output.
+	 *
+	 * @param input File data to convert
+	 * @param inputLength Number of bytes of file data
+	 * @param consumed Set to the number of input bytes that were converted
+	 * @param output Where the NETASCII data goes
+	 * @param outputSize Room in the output
+	 * @return Number of bytes written to the output
+	 */
+	size_t encode(const uint8_t* input, size_t inputLength, size_t& consumed, uint8_t* output, size_t outputSize);
+
+	/**
+	 * Write out anything still pending once the end of the file is reached
+	 * (the second half of a split sequence or the \0 after a \r at the very end).
+	 *
+	 * @param output Where the NETASCII data goes
+	 * @param outputSize Room in the output
+	 * @return Number of bytes written to the output
+	 */
+	size_t finish(uint8_t* output, size_t outputSize);
+
+	/**
+	 * @return The conversion state so it can be restored to go back to this point
+	 */
+	uint8_t state() const { return m_state; }
+
+	/**
+	 * Go back to a state returned by state()
+	 *
+	 * @param state Conversion state to restore
+	 */
+	void restore(uint8_t state) { m_state = state; }
+
+private:
+
+	/**
+	 * @enum encoderState_t
+	 * What has to happen before the next input byte
+	 */
+	enum encoderState_t {
+		NORMAL     = 0, ///< Nothing pending
+		AFTER_CR   = 1, ///< A \r went out; \n or \0 follows depending on the next input byte
+		PENDING_LF = 2  ///< The \n of a \r\n did not fit in the last output
+	};
+
+	uint8_t m_state;
+};
+
+/**
+ * @class NetasciiDecoder
+ *
+ * Converts NETASCII back to file data by dropping the \0 of every \r\0.  Line
+ * endings (\r\n) are kept as they are.  Output is never longer than the input so
+ * data is converted in place.
+ */
+class NetasciiDecoder {
+
+public:
+
+	NetasciiDecoder() : m_afterCarriageReturn(false) {}
+
+	/**
+	 * Start a new conversion
+	 */
+	void reset() { m_afterCarriageReturn = false; }
+
+	/**
+	 * Convert a chunk of NETASCII data in place.
+	 *
+	 * @param data NETASCII data which is replaced by file data
+	 * @param length Number of bytes of NETASCII data
+	 * @return Number of bytes of file data
+	 */
+	size_t decode(uint8_t* data, size_t length);
+
+private:
+
+	// the last chunk ended with a \r so a \0 at the start of the next one is dropped
+	bool m_afterCarriageReturn;
+};
+
+#endif /* _TFTPNETASCII_H_ */
@@ -0,0 +1,187 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpNetasciiIndex.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <TftpNetasciiIndex.h>
+
+// "TNAI" and the layout version
+const uint32_t INDEX_MAGIC = 0x544E4149;
+const uint32_t INDEX_VERSION = 3;
+
+// magic, version, file size, modified, block size, blocks, encoded size
+const size_t INDEX_HEADER_SIZE = 7 * 4;
+
+// file position and encoder state
+const size_t INDEX_ENTRY_SIZE = 5;
+
+// numbers are stored little endian no matter what the CPU is
+static void putWord (uint8_t* buffer, uint32_t value) {
+
+	buffer[0] = static_cast <uint8_t> (value);
+	buffer[1] = static_cast <uint8_t> (value >> 8);
+	buffer[2] = static_cast <uint8_t> (value >> 16);
+	buffer[3] = static_cast <uint8_t> (value >> 24);
+}
+
+static uint32_t getWord (const uint8_t* buffer) {
+
+	return static_cast <uint32_t> (buffer[0]) | (static_cast <uint32_t> (buffer[1]) << 8) |
+			(static_cast <uint32_t> (buffer[2]) << 16) | (static_cast <uint32_t> (buffer[3]) << 24);
+}
+
+bool TftpNetasciiIndex::load (const char* indexName, uint32_t fileSize, uint32_t modified,
+		uint16_t blockSize, uint32_t& encodedSize) {
+
+	if (!m_file.open (indexName, O_READ)) return false;
+
+	uint8_t header[INDEX_HEADER_SIZE];
+
+	if (m_file.read (header, INDEX_HEADER_SIZE) != static_cast <int> (INDEX_HEADER_SIZE)) {
+
+		m_file.close();
+
+		return false;
+	}
+
+	m_blocks = getWord (&header[20]);
+
+	// unfinished, from another version, for an older copy of the file or missing blocks
+	if (getWord (&header[0]) != INDEX_MAGIC || getWord (&header[4]) != INDEX_VERSION ||
+			getWord (&header[8]) != fileSize || getWord (&header[12]) != modified ||
+			getWord (&header[16]) != blockSize || m_blocks == 0 ||
+			m_file.fileSize() != INDEX_HEADER_SIZE + m_blocks * INDEX_ENTRY_SIZE) {
+
+		m_file.close();
+
+		return false;
+	}
+
+	encodedSize = getWord (&header[24]);
+
+	return true;
+}
+
+bool TftpNetasciiIndex::lookup (uint32_t block, uint32_t& filePosition, uint8_t& netasciiState) {
+
+	if (!isLoaded() || block >= m_blocks) return false;
+
+	uint8_t entry[INDEX_ENTRY_SIZE];
+
+	if (!m_file.seekSet (INDEX_HEADER_SIZE + block * INDEX_ENTRY_SIZE) ||
+			m_file.read (entry, INDEX_ENTRY_SIZE) != static_cast <int> (INDEX_ENTRY_SIZE)) {
+
+		return false;
+	}
+
+	filePosition = getWord (entry);
+	netasciiState = entry[4];
+
+	return true;
+}
+
+bool TftpNetasciiIndex::create (SdFat* sd, const char* indexName, uint32_t fileSize, uint32_t modified, uint16_t blockSize) {
+
+	if (sd->exists (indexName) && !sd->remove (indexName)) return false;
+
+	if (!m_file.open (indexName, O_RDWR | O_CREAT | O_EXCL)) return false;
+
+	m_building = true;
+	m_buffered = 0;
+	m_blocks = 0;
+
+	// a block count of 0 marks the index unfinished until finish() fills it in
+	uint8_t header[INDEX_HEADER_SIZE];
+
+	putWord (&header[0], INDEX_MAGIC);
+	putWord (&header[4], INDEX_VERSION);
+	putWord (&header[8], fileSize);
+	putWord (&header[12], modified);
+	putWord (&header[16], blockSize);
+	putWord (&header[20], 0);
+	putWord (&header[24], 0);
+
+	if (m_file.write (header, INDEX_HEADER_SIZE) != static_cast <int> (INDEX_HEADER_SIZE)) {
+
+		close (sd, indexName);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool TftpNetasciiIndex::add (uint32_t filePosition, uint8_t netasciiState) {
+
+	uint8_t* entry = &m_buffer[m_buffered * INDEX_ENTRY_SIZE];
+
+	putWord (entry, filePosition);
+	entry[4] = netasciiState;
+
+	m_blocks++;
+
+	if (++m_buffered == TFTP_NETASCII_INDEX_BUFFER) return flush();
+
+	return true;
+}
+
+bool TftpNetasciiIndex::flush() {
+
+	size_t length = m_buffered * INDEX_ENTRY_SIZE;
+
+	m_buffered = 0;
+
+	return m_file.write (m_buffer, length) == static_cast <int> (length);
+}
+
+bool TftpNetasciiIndex::finish (uint32_t encodedSize) {
+
+	if (!flush()) return false;
+
+	// fill in the totals, which makes the index good
+	uint8_t totals[8];
+
+	putWord (&totals[0], m_blocks);
+	putWord (&totals[4], encodedSize);
+
+	if (!m_file.seekSet (20) || m_file.write (totals, sizeof (totals)) != static_cast <int> (sizeof (totals))) return false;
+
+	m_building = false;
+
+	return m_file.close();
+}
+
+void TftpNetasciiIndex::close (SdFat* sd, const char* indexName) {
+
+	if (m_file.isOpen()) m_file.close();
+
+	// half an index is no use to anyone
+	if (m_building) sd->remove (indexName);
+
+	m_building = false;
+}
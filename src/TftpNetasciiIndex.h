@@ -0,0 +1,170 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpNetasciiIndex.h
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief Block index of a file sent in NETASCII mode
+ *
+ * NETASCII conversion makes blocks on the wire longer than the file data they come
+ * from, so block N doesn't start at N times the block size in the file.  While a file
+ * is sent for the first time the index records where every block starts in the file
+ * and the state of the encoder at that point, which is all it takes to rebuild any
+ * block with one seek.  Once the whole file has gone out the index also knows how
+ * many bytes the file is on the wire, which lets later RRQs answer the tsize option.
+ *
+ * The index is kept in a file next to the one it describes (name + ".nai").  Its header
+ * holds the size and modification time of the file and the block size, and the index
+ * is only used while all of them still match.  An index that never got finished has
+ * a block count of 0 and is ignored.
+ *
+ * Entries are collected in a small buffer and written TFTP_NETASCII_INDEX_BUFFER at a
+ * time, so building the index doesn't cost a card write for every block.  A finished
+ * index is opened for reading and a block is looked up with one seek and a 5 byte read.
+ */
+
+#ifndef _TFTPNETASCIIINDEX_H_
+#define _TFTPNETASCIIINDEX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <SdFat.h>
+
+/**
+ * Appended to a file name to get the name of its NETASCII index
+ */
+#ifndef TFTP_NETASCII_INDEX_SUFFIX
+#define TFTP_NETASCII_INDEX_SUFFIX ".nai"
+#endif
+
+/**
+ * Number of block entries collected before they are written to the index file
+ */
+#ifndef TFTP_NETASCII_INDEX_BUFFER
+#define TFTP_NETASCII_INDEX_BUFFER 32
+#endif
+
+/**
+ * @class TftpNetasciiIndex
+ */
+class TftpNetasciiIndex {
+
+public:
+
+	TftpNetasciiIndex() : m_building(false), m_buffered(0), m_blocks(0) {}
+
+	/**
+	 * Open a finished index that still matches its file for lookups
+	 *
+	 * @param indexName Name of the index file
+	 * @param fileSize Current size of the file
+	 * @param modified Current modification time of the file
+	 * @param blockSize Block size of the transfer
+	 * @param encodedSize Set to the size of the file in NETASCII
+	 * @return True if the index is good, false otherwise.
+	 */
+	bool load(const char* indexName, uint32_t fileSize, uint32_t modified,
+			uint16_t blockSize, uint32_t& encodedSize);
+
+	/**
+	 * Find where a block of a loaded index starts
+	 *
+	 * @param block Block to look up, counting from 0 for the first block of the file
+	 * @param filePosition Set to the file position of the first byte of the block
+	 * @param netasciiState Set to the NETASCII encoder state at the start of the block
+	 * @return True if the block is in the index, false otherwise.
+	 */
+	bool lookup(uint32_t block, uint32_t& filePosition, uint8_t& netasciiState);
+
+	/**
+	 * Start a new index, replacing any old one
+	 *
+	 * @param sd File system
+	 * @param indexName Name of the index file
+	 * @param fileSize Size of the file
+	 * @param modified Modification time of the file
+	 * @param blockSize Block size of the transfer
+	 * @return True if the index file could be created, false otherwise.
+	 */
+	bool create(SdFat* sd, const char* indexName, uint32_t fileSize, uint32_t modified, uint16_t blockSize);
+
+	/**
+	 * Record the next block.  Blocks have to be added in order.
+	 *
+	 * @param filePosition File position of the first byte of the block
+	 * @param netasciiState NETASCII encoder state at the start of the block
+	 * @return True on success or False on a file write error.
+	 */
+	bool add(uint32_t filePosition, uint8_t netasciiState);
+
+	/**
+	 * Write out the rest of the entries, mark the index good and close it
+	 *
+	 * @param encodedSize Size of the file in NETASCII
+	 * @return True on success or False on a file write error.
+	 */
+	bool finish(uint32_t encodedSize);
+
+	/**
+	 * Close the index, deleting it if it was being built
+	 *
+	 * @param sd File system
+	 * @param indexName Name of the index file
+	 */
+	void close(SdFat* sd, const char* indexName);
+
+	/**
+	 * @return True while an index is being built or is loaded
+	 */
+	bool isOpen() const { return m_file.isOpen(); }
+
+	/**
+	 * @return True while an index is being built
+	 */
+	bool isBuilding() const { return m_building; }
+
+	/**
+	 * @return True if a finished index is loaded for lookups
+	 */
+	bool isLoaded() const { return m_file.isOpen() && !m_building; }
+
+private:
+
+	/**
+	 * Write the buffered entries to the index file
+	 *
+	 * @return True on success or False on a file write error.
+	 */
+	bool flush();
+
+	File m_file;
+	bool m_building;
+	uint8_t m_buffer[TFTP_NETASCII_INDEX_BUFFER * 5];
+	uint8_t m_buffered;
+	uint32_t m_blocks;
+};
+
+#endif /* _TFTPNETASCIIINDEX_H_ */
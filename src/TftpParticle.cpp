@@ -0,0 +1,136 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpParticle.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <TftpParticle.h>
+
+#if defined(PARTICLE)
+
+// ports for transfers come from the dynamic range (RFC 6335)
+const uint16_t EPHEMERAL_PORT_MIN = 49152;
+const uint16_t EPHEMERAL_PORT_MAX = 65535;
+const uint8_t MAX_PORT_ATTEMPTS = 8;
+
+bool ParticleUdpSocket::begin (uint16_t port) {
+
+	// pick a random ephemeral port if none was given and try a few in case one is taken
+	for (uint8_t i = 0; i < MAX_PORT_ATTEMPTS; ++i) {
+
+		m_localPort = (port != 0) ? port : random (EPHEMERAL_PORT_MIN, EPHEMERAL_PORT_MAX);
+
+		if (m_udp.begin (m_localPort)) {
+
+			return true;
+		}
+
+		if (port != 0) break;
+	}
+
+	return false;
+}
+
+void ParticleUdpSocket::stop() {
+
+	m_udp.stop();
+}
+
+int ParticleUdpSocket::receivePacket (uint8_t* buffer, size_t size) {
+
+	return m_udp.receivePacket (buffer, size);
+}
+
+int ParticleUdpSocket::sendPacket (const uint8_t* buffer, size_t length, uint32_t remoteIp, uint16_t remotePort) {
+
+	return m_udp.sendPacket (buffer, length, IPAddress (remoteIp), remotePort);
+}
+
+bool ParticleNetwork::begin() {
+
+	// ensure that WiFi is running before trying to start UDP
+	if (!WiFi.ready()) {
+
+		WiFi.connect();
+
+		waitUntil (WiFi.ready);
+	}
+
+	return true;
+}
+
+TftpSocket* ParticleNetwork::openSocket (uint16_t port) {
+
+	for (uint8_t i = 0; i < TFTP_MAX_SESSIONS + 1; ++i) {
+
+		if (!m_inUse[i]) {
+
+			if (!m_sockets[i].begin (port)) return NULL;
+
+			m_inUse[i] = true;
+
+			return &m_sockets[i];
+		}
+	}
+
+	return NULL;
+}
+
+void ParticleNetwork::closeSocket (TftpSocket* socket) {
+
+	for (uint8_t i = 0; i < TFTP_MAX_SESSIONS + 1; ++i) {
+
+		if (socket == &m_sockets[i]) {
+
+			m_sockets[i].stop();
+			m_inUse[i] = false;
+		}
+	}
+}
+
+TftpNetwork& tftpDefaultNetwork() {
+
+	static ParticleNetwork network;
+
+	return network;
+}
+
+TftpClock& tftpDefaultClock() {
+
+	static ParticleClock clock;
+
+	return clock;
+}
+
+TftpLog& tftpDefaultLog() {
+
+	static ParticleSerialLog log;
+
+	return log;
+}
+
+#endif /* PARTICLE */
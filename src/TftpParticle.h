@@ -0,0 +1,108 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpParticle.h
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief Particle implementation of the TFTP platform interfaces
+ *
+ * UDP sockets over WiFi, millis()/micros() and Serial.  These are the defaults
+ * used by TftpServer::begin() on a Particle device.
+ */
+
+#ifndef _TFTPPARTICLE_H_
+#define _TFTPPARTICLE_H_
+
+#if defined(PARTICLE)
+
+#include <Particle.h>
+#include <TftpServer.h>
+
+/**
+ * @class ParticleUdpSocket
+ */
+class ParticleUdpSocket : public TftpSocket {
+
+public:
+
+	ParticleUdpSocket() : m_localPort(0) {}
+
+	bool begin(uint16_t port);
+	void stop();
+	uint16_t localPort() { return m_localPort; }
+	int receivePacket(uint8_t* buffer, size_t size);
+	int sendPacket(const uint8_t* buffer, size_t length, uint32_t remoteIp, uint16_t remotePort);
+	uint32_t remoteIP() { return m_udp.remoteIP(); }
+	uint16_t remotePort() { return m_udp.remotePort(); }
+
+private:
+
+	UDP m_udp;
+	uint16_t m_localPort;
+};
+
+/**
+ * @class ParticleNetwork
+ * WiFi with a fixed pool of UDP sockets: one for the TFTP port and one per transfer
+ */
+class ParticleNetwork : public TftpNetwork {
+
+public:
+
+	bool begin();
+	TftpSocket* openSocket(uint16_t port);
+	void closeSocket(TftpSocket* socket);
+
+private:
+
+	ParticleUdpSocket m_sockets[TFTP_MAX_SESSIONS + 1];
+	bool m_inUse[TFTP_MAX_SESSIONS + 1] = {};
+};
+
+/**
+ * @class ParticleClock
+ */
+class ParticleClock : public TftpClock {
+
+public:
+
+	uint32_t millis() { return ::millis(); }
+	uint32_t micros() { return ::micros(); }
+};
+
+/**
+ * @class ParticleSerialLog
+ */
+class ParticleSerialLog : public TftpLog {
+
+public:
+
+	void write(const char* text) { Serial.print (text); }
+};
+
+#endif /* PARTICLE */
+
+#endif /* _TFTPPARTICLE_H_ */
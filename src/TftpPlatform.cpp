@@ -0,0 +1,54 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpPlatform.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <TftpPlatform.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+// longest line of debug output
+const size_t LOG_LINE_SIZE = 160;
+
+void TftpLog::println (const char* text) {
+
+	write (text);
+	write ("\n");
+}
+
+void TftpLog::printlnf (const char* format, ...) {
+
+	char line [LOG_LINE_SIZE];
+
+	va_list arguments;
+	va_start (arguments, format);
+	vsnprintf (line, sizeof (line), format, arguments);
+	va_end (arguments);
+
+	println (line);
+}
@@ -0,0 +1,223 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpPlatform.h
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief Network, clock and logging interfaces used by the TFTP server
+ *
+ * The server only talks to the outside world through these small interfaces so the
+ * same protocol code runs on a Particle device (UDP, millis() and Serial, see
+ * TftpParticle.h) and on a Linux host (POSIX sockets, clock_gettime() and stderr,
+ * see host/TftpPosix.h).  Tests and benchmarks can plug in their own versions, for
+ * example a simulated network with a virtual clock.
+ *
+ * IPv4 addresses are passed around as a uint32_t with the first octet in the most
+ * significant byte, which is what Particle's IPAddress converts to and from.
+ */
+
+#ifndef _TFTPPLATFORM_H_
+#define _TFTPPLATFORM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#if !defined(PARTICLE)
+// Arduino style helper that the Particle environment already provides
+#ifndef constrain
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#endif
+#endif
+
+/**
+ * @class TftpSocket
+ * A non-blocking UDP socket
+ */
+class TftpSocket {
+
+public:
+
+	virtual ~TftpSocket() {}
+
+	/**
+	 * Bind the socket to a local port (again after an error).
+	 *
+	 * @param port Local port number.  0 picks a free ephemeral port.
+	 * @return True on success, false otherwise.
+	 */
+	virtual bool begin(uint16_t port) = 0;
+
+	/**
+	 * Close the socket
+	 */
+	virtual void stop() = 0;
+
+	/**
+	 * @return Local port number the socket is bound to
+	 */
+	virtual uint16_t localPort() = 0;
+
+	/**
+	 * Check for a packet without waiting.
+	 *
+	 * @param buffer Where the packet goes
+	 * @param size Size of the buffer
+	 * @return Length of the packet, 0 if there is none or negative on a socket error.
+	 */
+	virtual int receivePacket(uint8_t* buffer, size_t size) = 0;
+
+	/**
+	 * Send a packet
+	 *
+	 * @param buffer Packet to send
+	 * @param length Length of the packet
+	 * @param remoteIp IPv4 address to send the packet to
+	 * @param remotePort Port number to send the packet to
+	 * @return Number of bytes sent or negative on a socket error.
+	 */
+	virtual int sendPacket(const uint8_t* buffer, size_t length, uint32_t remoteIp, uint16_t remotePort) = 0;
+
+	/**
+	 * @return IPv4 address of the sender of the last packet received
+	 */
+	virtual uint32_t remoteIP() = 0;
+
+	/**
+	 * @return Port number of the sender of the last packet received
+	 */
+	virtual uint16_t remotePort() = 0;
+};
+
+/**
+ * @class TftpNetwork
+ * Hands out sockets.  Implementations keep a fixed pool so nothing is allocated
+ * on the heap.
+ */
+class TftpNetwork {
+
+public:
+
+	virtual ~TftpNetwork() {}
+
+	/**
+	 * Wait for the network to come up
+	 *
+	 * @return True when the network is ready to use.
+	 */
+	virtual bool begin() { return true; }
+
+	/**
+	 * Open a socket bound to a local port.
+	 *
+	 * @param port Local port number.  0 picks a free ephemeral port.
+	 * @return The socket or NULL if none is available.
+	 */
+	virtual TftpSocket* openSocket(uint16_t port) = 0;
+
+	/**
+	 * Close a socket and give it back to the pool
+	 *
+	 * @param socket Socket returned by openSocket()
+	 */
+	virtual void closeSocket(TftpSocket* socket) = 0;
+};
+
+/**
+ * @class TftpClock
+ * Monotonic time
+ */
+class TftpClock {
+
+public:
+
+	virtual ~TftpClock() {}
+
+	/**
+	 * @return Milliseconds since an arbitrary starting point.  Wraps around.
+	 */
+	virtual uint32_t millis() = 0;
+
+	/**
+	 * @return Microseconds since an arbitrary starting point.  Wraps around.
+	 */
+	virtual uint32_t micros() = 0;
+};
+
+/**
+ * @class TftpLog
+ * Where debug output goes
+ */
+class TftpLog {
+
+public:
+
+	virtual ~TftpLog() {}
+
+	/**
+	 * Write some text as is
+	 *
+	 * @param text Null terminated text
+	 */
+	virtual void write(const char* text) = 0;
+
+	/**
+	 * Write some text
+	 *
+	 * @param text Null terminated text
+	 */
+	void print(const char* text) { write(text); }
+
+	/**
+	 * Write some text followed by a new line
+	 *
+	 * @param text Null terminated text
+	 */
+	void println(const char* text);
+
+	/**
+	 * Write printf style formatted text followed by a new line
+	 *
+	 * @param format printf format string
+	 */
+	void printlnf(const char* format, ...) __attribute__ ((format (printf, 2, 3)));
+};
+
+/**
+ * @return The network of the platform the library is built for
+ */
+TftpNetwork& tftpDefaultNetwork();
+
+/**
+ * @return The clock of the platform the library is built for
+ */
+TftpClock& tftpDefaultClock();
+
+/**
+ * @return The debug output of the platform the library is built for
+ */
+TftpLog& tftpDefaultLog();
+
+#endif /* _TFTPPLATFORM_H_ */
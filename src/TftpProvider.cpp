@@ -0,0 +1,92 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpProvider.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <TftpProvider.h>
+#include <string.h>
+
+void TftpRingBufferProvider::append (const uint8_t* data, size_t length) {
+
+	if (m_capacity == 0) return;
+
+	// only the tail of a very long append survives anyway
+	if (length > m_capacity) {
+
+		m_written += length - m_capacity;
+		data += length - m_capacity;
+		length = m_capacity;
+	}
+
+	// copy in up to two pieces when the data wraps around the end of the storage
+	size_t offset = m_written % m_capacity;
+	size_t first = m_capacity - offset;
+
+	if (first > length) first = length;
+
+	memcpy (&m_storage[offset], data, first);
+	memcpy (m_storage, &data[first], length - first);
+
+	m_written += length;
+}
+
+void TftpRingBufferProvider::append (const char* text) {
+
+	append (reinterpret_cast <const uint8_t*> (text), strlen (text));
+}
+
+bool TftpRingBufferProvider::openRead (TftpVirtualFile& file) {
+
+	// the transfer covers what is in the buffer right now
+	file.start = m_written > m_capacity ? m_written - m_capacity : 0;
+	file.size = m_written - file.start;
+
+	return true;
+}
+
+int TftpRingBufferProvider::read (TftpVirtualFile& file, uint32_t position, uint8_t* buffer, size_t count) {
+
+	if (position >= file.size) return 0;
+
+	if (count > file.size - position) count = file.size - position;
+
+	uint32_t from = file.start + position;
+
+	// newer data has already been written over this part
+	if (m_written - from > m_capacity) return -1;
+
+	size_t offset = from % m_capacity;
+	size_t first = m_capacity - offset;
+
+	if (first > count) first = count;
+
+	memcpy (buffer, &m_storage[offset], first);
+	memcpy (&buffer[first], m_storage, count - first);
+
+	return static_cast <int> (count);
+}
@@ -0,0 +1,170 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpProvider.h
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief Files that are generated in code instead of stored on the SD card
+ *
+ * A provider is registered with the server under a file name (or a name prefix).
+ * Read requests for a matching name are answered with bytes the provider hands out,
+ * and go through the same DATA/ACK path, options, windows and retransmissions as
+ * files on the card.  Write requests for a matching name feed the received bytes to
+ * the provider instead of creating a file.
+ *
+ * Reads are by position rather than in sequence because a lost window makes the
+ * server go back and send earlier blocks again.  A provider that can't produce the
+ * same bytes twice should take a snapshot in openRead().
+ *
+ * TftpRingBufferProvider is a ready-made provider that serves whatever was last
+ * appended to a RAM ring buffer, for example a log.
+ */
+
+#ifndef _TFTPPROVIDER_H_
+#define _TFTPPROVIDER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Size reported by openRead() when the length is not known up front.  The transfer
+ * simply ends at the first short read and the tsize option is not answered.
+ */
+#define TFTP_UNKNOWN_SIZE 0xFFFFFFFF
+
+/**
+ * @struct TftpVirtualFile
+ * One transfer of a generated file, handed to every call of the provider
+ */
+struct TftpVirtualFile {
+	const char* name;                        ///< file name the client asked for
+	uint32_t size;                           ///< read: set by openRead(), write: size announced by the client or 0
+	uint32_t start;                          ///< free for the provider to use
+	void* context;                           ///< free for the provider to use
+};
+
+/**
+ * @class TftpFileProvider
+ * Override the calls for the directions the provider supports, the rest refuse.
+ */
+class TftpFileProvider {
+
+public:
+
+	virtual ~TftpFileProvider() {}
+
+	/**
+	 * A client wants to read the file
+	 *
+	 * @param file The transfer.  Set size (or TFTP_UNKNOWN_SIZE).
+	 * @return True to send the file, false to answer "file not found"
+	 */
+	virtual bool openRead(TftpVirtualFile& /* file */) { return false; }
+
+	/**
+	 * Hand out part of the file
+	 *
+	 * @param file The transfer
+	 * @param position Where in the file to start
+	 * @param buffer Where the data goes
+	 * @param count Number of bytes wanted
+	 * @return Number of bytes, less than count only at the end of the file, -1 on error
+	 */
+	virtual int read(TftpVirtualFile& /* file */, uint32_t /* position */, uint8_t* /* buffer */, size_t /* count */) { return -1; }
+
+	/**
+	 * A client wants to write the file
+	 *
+	 * @param file The transfer
+	 * @return True to accept the data, false to answer "access violation"
+	 */
+	virtual bool openWrite(TftpVirtualFile& /* file */) { return false; }
+
+	/**
+	 * Take the next part of the file.  Data arrives in order and only once.
+	 *
+	 * @param file The transfer
+	 * @param position Where in the file the data goes
+	 * @param data The data
+	 * @param length Number of bytes
+	 * @return False to abort the transfer
+	 */
+	virtual bool write(TftpVirtualFile& /* file */, uint32_t /* position */, const uint8_t* /* data */, size_t /* length */) { return false; }
+
+	/**
+	 * The transfer is over.  Called once for every successful openRead() or openWrite().
+	 *
+	 * @param file The transfer
+	 * @param completed True if every byte made it across
+	 */
+	virtual void close(TftpVirtualFile& /* file */, bool /* completed */) {}
+};
+
+/**
+ * @class TftpRingBufferProvider
+ * Serves the last bytes appended to a ring buffer.  Each read request gets what the
+ * buffer held when it arrived; if the transfer falls so far behind that part of it
+ * is overwritten the transfer is aborted.
+ */
+class TftpRingBufferProvider : public TftpFileProvider {
+
+public:
+
+	/**
+	 * @param storage RAM for the buffer, owned by the caller
+	 * @param capacity Size of storage in bytes
+	 */
+	TftpRingBufferProvider(uint8_t* storage, size_t capacity) : m_storage(storage), m_capacity(capacity), m_written(0) {}
+
+	/**
+	 * Add bytes to the buffer, dropping the oldest ones when it is full
+	 *
+	 * @param data The data
+	 * @param length Number of bytes
+	 */
+	void append(const uint8_t* data, size_t length);
+
+	/**
+	 * Add a null terminated string to the buffer
+	 */
+	void append(const char* text);
+
+	/**
+	 * Empty the buffer
+	 */
+	void clear() { m_written = 0; }
+
+	virtual bool openRead(TftpVirtualFile& file);
+	virtual int read(TftpVirtualFile& file, uint32_t position, uint8_t* buffer, size_t count);
+
+private:
+
+	uint8_t* m_storage;
+	size_t m_capacity;
+	uint32_t m_written;                      ///< bytes appended since the buffer was empty
+};
+
+#endif /* _TFTPPROVIDER_H_ */
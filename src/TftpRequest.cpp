@@ -0,0 +1,111 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpRequest.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <TftpRequest.h>
+#include <string.h>
+#include <strings.h>
+
+bool TftpRequest::parse (const uint8_t* packet, size_t length) {
+
+	m_opCode = 0;
+	m_fileName = NULL;
+	m_mode = NULL;
+	m_optionCount = 0;
+
+	if (length < 2) return false;
+
+	m_opCode = static_cast <uint16_t> ((packet[0] << 8) | packet[1]);
+
+	size_t position = 2;
+
+	m_fileName = text (packet, length, position);
+	m_mode = text (packet, length, position);
+
+	if (m_fileName == NULL || m_mode == NULL || *m_fileName == '\0' || *m_mode == '\0') return false;
+
+	// options are pairs of strings up to the end of the packet
+	while (position < length) {
+
+		const char* name = text (packet, length, position);
+		const char* value = text (packet, length, position);
+
+		if (name == NULL || value == NULL || *name == '\0') return false;
+
+		if (m_optionCount < TFTP_MAX_OPTIONS) {
+
+			m_options[m_optionCount].name = name;
+			m_options[m_optionCount].value = value;
+
+			m_optionCount++;
+		}
+	}
+
+	return true;
+}
+
+bool TftpRequest::modeIs (const char* mode) const {
+
+	return m_mode != NULL && strcasecmp (m_mode, mode) == 0;
+}
+
+bool TftpRequest::toNumber (const char* text, uint32_t& value) {
+
+	uint64_t number = 0;
+
+	if (*text == '\0') return false;
+
+	for (; *text != '\0'; ++text) {
+
+		if (*text < '0' || *text > '9') return false;
+
+		number = number * 10 + (*text - '0');
+
+		if (number > 0xFFFFFFFF) return false;
+	}
+
+	value = static_cast <uint32_t> (number);
+
+	return true;
+}
+
+const char* TftpRequest::text (const uint8_t* packet, size_t length, size_t& position) {
+
+	if (position >= length) return NULL;
+
+	const void* end = memchr (&packet[position], 0, length - position);
+
+	if (end == NULL) return NULL;
+
+	const char* start = reinterpret_cast <const char*> (&packet[position]);
+
+	position = static_cast <const uint8_t*> (end) - packet + 1;
+
+	return start;
+}
@@ -0,0 +1,147 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpRequest.h
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief Parser for RRQ and WRQ packets that works in place
+ *
+ * Every string of a request (file name, mode and the option names and values that
+ * may follow, RFC 2347) is null terminated inside the packet, so once the parser has
+ * checked that each one ends before the packet does it can hand out pointers into
+ * the packet instead of copies.  Nothing is allocated and no byte past the end of the
+ * packet is ever looked at.  Packets that are cut short, have an empty file name or
+ * mode, or an option without a value are refused.
+ *
+ * The results point into the packet, so they are only good until it is overwritten.
+ */
+
+#ifndef _TFTPREQUEST_H_
+#define _TFTPREQUEST_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Number of options kept from one request, any beyond are ignored
+ */
+#ifndef TFTP_MAX_OPTIONS
+#define TFTP_MAX_OPTIONS 8
+#endif
+
+/**
+ * @class TftpRequest
+ */
+class TftpRequest {
+
+public:
+
+	TftpRequest() : m_opCode(0), m_fileName(NULL), m_mode(NULL), m_optionCount(0) {}
+
+	/**
+	 * Take a request apart
+	 *
+	 * @param packet The packet, starting with the opcode
+	 * @param length Bytes in the packet
+	 * @return False if the packet isn't a well formed request.  The opcode is still
+	 * set if the packet has one.
+	 */
+	bool parse(const uint8_t* packet, size_t length);
+
+	/**
+	 * @return The opcode, 0 if the packet was too short to have one
+	 */
+	uint16_t opCode() const { return m_opCode; }
+
+	/**
+	 * @return The file name, null terminated
+	 */
+	const char* fileName() const { return m_fileName; }
+
+	/**
+	 * @return The transfer mode as the client sent it, null terminated
+	 */
+	const char* mode() const { return m_mode; }
+
+	/**
+	 * @param mode Mode to compare with
+	 * @return True if the transfer mode is mode, ignoring case
+	 */
+	bool modeIs(const char* mode) const;
+
+	/**
+	 * @return Number of options
+	 */
+	uint8_t optionCount() const { return m_optionCount; }
+
+	/**
+	 * @param index Option from 0 to optionCount() - 1
+	 * @return Name of the option as the client sent it
+	 */
+	const char* optionName(uint8_t index) const { return m_options[index].name; }
+
+	/**
+	 * @param index Option from 0 to optionCount() - 1
+	 * @return Value of the option
+	 */
+	const char* optionValue(uint8_t index) const { return m_options[index].value; }
+
+	/**
+	 * Read a decimal option value.  Only digits are allowed and the number has to fit
+	 * in 32 bits.
+	 *
+	 * @param text The value
+	 * @param value Where the number goes
+	 * @return False if the text isn't a number
+	 */
+	static bool toNumber(const char* text, uint32_t& value);
+
+private:
+
+	/**
+	 * @struct option_t
+	 * One option name/value pair
+	 */
+	struct option_t {
+		const char* name;
+		const char* value;
+	};
+
+	/**
+	 * Find the end of the string at position
+	 *
+	 * @return The string or NULL if it runs past the end of the packet
+	 */
+	static const char* text(const uint8_t* packet, size_t length, size_t& position);
+
+	uint16_t m_opCode;
+	const char* m_fileName;
+	const char* m_mode;
+	option_t m_options[TFTP_MAX_OPTIONS];
+	uint8_t m_optionCount;
+};
+
+#endif /* _TFTPREQUEST_H_ */
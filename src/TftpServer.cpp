@@ -29,629 +29,2444 @@
  */
 
 #include <TftpServer.h>
+#include <strings.h>
 
 const uint32_t INITIAL_TIMEOUT = 50; // milliseconds
-const uint32_t TIMEOUT_MIN = 50; 	 // milliseconds
-const uint32_t TIMEOUT_MAX = 10000;  // milliseconds
 const uint8_t MAX_RETRANSMISSIONS = 8;
 
-// TFTP data packets use 512 bytes of data and 4 bytes of header
-const size_t UDP_BUFFER_SIZE = 516;
-uint8_t udpBuffer [UDP_BUFFER_SIZE];
+// a queued request is dropped when its client hasn't repeated it for this long
+const uint32_t BACKLOG_IDLE_TIMEOUT = 30000; // milliseconds
+
+// TFTP data packets use 512 bytes of data unless a larger block size is negotiated
+const uint16_t DEFAULT_BLOCK_SIZE = 512;
+const uint32_t BLOCK_SIZE_MIN = 8;      // RFC 2348
+const uint32_t BLOCK_SIZE_MAX = 65464;  // RFC 2348
+const uint32_t WINDOW_SIZE_MIN = 1;     // RFC 7440
+const uint32_t WINDOW_SIZE_MAX = 65535; // RFC 7440
+
+// the write-behind buffer needs room for a full block on top of a partial sector
+const uint16_t SD_SECTOR_SIZE = 512;
+static_assert (TFTP_WRITE_BUFFER_SIZE >= TFTP_MAX_BLOCK_SIZE + SD_SECTOR_SIZE - 1,
+		"TFTP_WRITE_BUFFER_SIZE is too small for TFTP_MAX_BLOCK_SIZE");
+
+// every session needs a packet buffer of its own to read a block into
+static_assert (TFTP_PACKET_SLOTS >= TFTP_MAX_SESSIONS && TFTP_PACKET_SLOTS <= 127,
+		"TFTP_PACKET_SLOTS has to be between TFTP_MAX_SESSIONS and 127");
+
+// the largest OACK has to fit in the control packet
+static_assert (TFTP_CONTROL_PACKET_SIZE >= 64, "TFTP_CONTROL_PACKET_SIZE is too small for an OACK");
+
+// a NETASCII index rather than a file of the sketch
+static bool isNetasciiIndexName (const char* name) {
+
+	size_t length = strlen (name);
+	size_t suffixLength = strlen (TFTP_NETASCII_INDEX_SUFFIX);
+
+	return length >= suffixLength && strcasecmp (&name[length - suffixLength], TFTP_NETASCII_INDEX_SUFFIX) == 0;
+}
+
+// write a "name\0value\0" option pair into an OACK buffer and return its length
+static size_t appendOption (uint8_t* buffer, const char* name, uint32_t value) {
+
+	size_t length = strlen (name) + 1;
+
+	memcpy (buffer, name, length);
+
+	length += snprintf (reinterpret_cast <char*> (&buffer[length]), 11, "%lu", static_cast <unsigned long> (value)) + 1;
+
+	return length;
+}
 
 // Start your engines!
-bool TftpServer::begin (SdFat* sd, bool serialDebug, uint16_t portNumber) {
+bool TftpServer::begin (SdFat* sd, bool serialDebug, uint16_t portNumber, size_t cacheSize) {
+
+	return begin (sd, tftpDefaultNetwork(), tftpDefaultClock(), tftpDefaultLog(), serialDebug, portNumber, cacheSize);
+}
+
+// Start your engines somewhere else!
+bool TftpServer::begin (SdFat* sd, TftpNetwork& network, TftpClock& clock, TftpLog& log,
+		bool serialDebug, uint16_t portNumber, size_t cacheSize) {
+
+	m_localPort = portNumber;
+
+	m_network = &network;
+	m_clock = &clock;
+	m_log = &log;
+
+	// ensure that the network is running before trying to start UDP
+	m_network->begin();
+
+	// start UDP at the specified port number
+	m_tftp = m_network->openSocket (m_localPort);
+
+	// pointers to the file system from main application
+	m_sd = sd;
+
+	// Send errors and timeout messages to the debug output
+	m_serialDebug = serialDebug;
+
+	// RAM for small files that are read a lot.  Without it files just come from the card.
+	if (!m_cache.begin (cacheSize)) {
+
+		if (debugOutput()) m_log->printlnf ("***ERROR: Unable to allocate a %u byte file cache", static_cast <unsigned> (cacheSize));
+	}
+
+	// where the files on the card are, if asked for
+	setDirectoryIndex (m_directoryFiles);
+
+	// no transfers yet
+	for (uint8_t i = 0; i < TFTP_MAX_SESSIONS; ++i) {
+		m_sessions[i].state = SESSION_FREE;
+		m_sessions[i].socket = NULL;
+		m_sessions[i].ownSlot = i;
+	}
+
+	// nobody waiting
+	m_backlogCount = 0;
+
+	// and no packets waiting to go out
+	for (uint8_t i = 0; i < TFTP_PACKET_SLOTS; ++i) {
+		m_packetSlotUsed[i] = false;
+	}
+
+	return m_tftp != NULL;
+}
+
+// shut it down
+void TftpServer::stop() {
+
+	m_network->closeSocket (m_tftp);
+	m_tftp = NULL;
+
+	// abandon any transfers in progress
+	for (uint8_t i = 0; i < TFTP_MAX_SESSIONS; ++i) {
+
+		if (m_sessions[i].state != SESSION_FREE) endSession (m_sessions[i]);
+	}
+
+	// give the cache and index memory back
+	m_cache.end();
+	m_directory.end();
+}
+
+bool TftpServer::checkForPacket() {
+
+	return receivePacket (*m_tftp);
+}
+
+// Take care of all your client's needs!
+void TftpServer::processRequest() {
+
+	// start a transfer for the request that was just received
+	startSession();
+
+	// block until it (and anything that arrived in the meantime) is finished
+	while (poll());
+}
+
+// choose between speed and safety for uploads
+void TftpServer::setWriteDurability (durability_t durability, uint32_t syncInterval) {
+
+	m_durability = durability;
+	m_syncInterval = syncInterval;
+}
+
+// how long to wait before a retransmit
+void TftpServer::setTimeoutRange (uint32_t timeoutMin, uint32_t timeoutMax) {
+
+	m_timeoutMin = timeoutMin;
+	m_timeoutMax = (timeoutMax > timeoutMin) ? timeoutMax : timeoutMin;
+}
+
+// keep from flooding the radio
+void TftpServer::setPacing (uint32_t bytesPerSecond, uint32_t burstBytes) {
+
+	// a bucket smaller than a packet would never let one through
+	if (burstBytes < TFTP_MAX_BLOCK_SIZE + 4) burstBytes = TFTP_MAX_BLOCK_SIZE + 4;
+
+	m_paceRate = bytesPerSecond;
+	m_paceBurst = burstBytes;
+
+	// start with a full bucket, the clock is read by the first paced packet since
+	// this may be called before begin()
+	m_paceTokens = burstBytes;
+	m_paceStarted = false;
+}
+
+// skip the directory scans
+bool TftpServer::setDirectoryIndex (uint16_t maxFiles) {
+
+	m_directoryFiles = maxFiles;
+
+	// built by begin()
+	if (m_sd == NULL) return true;
+
+	stopRawStream();
+
+	if (!m_directory.begin (maxFiles)) {
+
+		if (debugOutput()) m_log->printlnf ("***ERROR: Unable to index more than %u files", static_cast <unsigned> (maxFiles));
+
+		return false;
+	}
+
+	if (debugOutput() && maxFiles > 0) m_log->printlnf ("Indexed %u files", static_cast <unsigned> (m_directory.count()));
+
+	return true;
+}
+
+bool TftpServer::indexFile (const char* name) {
+
+	File file;
+
+	if (m_sd == NULL) return false;
+
+	stopRawStream();
+
+	TftpDirectoryIndex::lookup_t lookup = m_directory.open (name, file, O_READ);
+
+	// already there, or there is no index to add it to
+	if (lookup != TftpDirectoryIndex::LOOKUP_NOT_FOUND) {
+
+		if (file.isOpen()) file.close();
+
+		return lookup == TftpDirectoryIndex::LOOKUP_FOUND || m_sd->exists (name);
+	}
+
+	if (!file.open (name, O_READ)) return false;
+
+	m_directory.add (name, file);
+
+	file.close();
+
+	return true;
+}
+
+// generated files
+bool TftpServer::addProvider (const char* name, TftpFileProvider* provider, bool prefix) {
+
+	if (m_providerCount >= TFTP_MAX_PROVIDERS || provider == NULL || strlen (name) >= TFTP_PROVIDER_NAME_SIZE) {
+
+		return false;
+	}
+
+	providerEntry_t& entry = m_providers[m_providerCount++];
+
+	strcpy (entry.name, name);
+	entry.prefix = prefix;
+	entry.provider = provider;
+
+	return true;
+}
+
+TftpFileProvider* TftpServer::findProvider (const char* name) const {
+
+	const providerEntry_t* best = NULL;
+	size_t bestLength = 0;
+
+	for (uint8_t i = 0; i < m_providerCount; ++i) {
+
+		const providerEntry_t& entry = m_providers[i];
+
+		// an exact name beats any prefix
+		if (strcmp (entry.name, name) == 0) return entry.provider;
+
+		size_t length = strlen (entry.name);
+
+		if (entry.prefix && length > bestLength && strncmp (entry.name, name, length) == 0) {
+
+			best = &entry;
+			bestLength = length;
+		}
+	}
+
+	return best != NULL ? best->provider : NULL;
+}
+
+// token bucket
+bool TftpServer::paceAllows (size_t length) {
+
+	if (m_paceRate == 0) return true;
+
+	uint32_t now = m_clock->micros();
+
+	if (!m_paceStarted) {
+
+		m_paceRefilled = now;
+		m_paceStarted = true;
+	}
+
+	// whole bytes earned since the last top up.  The time for a fraction of a byte
+	// carries over so slow rates still add up.
+	uint32_t earned = static_cast <uint32_t> ((static_cast <uint64_t> (now - m_paceRefilled) * m_paceRate) / 1000000);
+
+	if (earned > 0) {
+
+		m_paceRefilled += static_cast <uint32_t> ((static_cast <uint64_t> (earned) * 1000000) / m_paceRate);
+		m_paceTokens += earned;
+	}
+
+	// a full bucket stops filling
+	if (m_paceTokens >= m_paceBurst) {
+
+		m_paceTokens = m_paceBurst;
+		m_paceRefilled = now;
+	}
+
+	return m_paceTokens >= length;
+}
+
+// start counting again
+void TftpServer::resetStats() {
+
+	m_stats = serverStats_t();
+}
+
+// a transfer that is still running
+bool TftpServer::getTransferStats (uint8_t index, transferStats_t& stats) const {
+
+	if (index >= TFTP_MAX_SESSIONS || m_sessions[index].state == SESSION_FREE) {
+
+		return false;
+	}
+
+	stats = m_sessions[index].stats;
+
+	return true;
+}
+
+// keep everything moving
+bool TftpServer::poll() {
+
+	// as much as there is to do right now
+	return step (0xFFFFFFFF);
+}
+
+// keep everything moving, but only for a while
+bool TftpServer::step (uint32_t budgetMicros) {
+
+	m_stepStart = m_clock->micros();
+	m_stepBudget = budgetMicros;
+
+	// requests that have been waiting go before new ones
+	if (m_backlogCount > 0) admitQueuedRequests();
+
+	// start a transfer for any new request on the TFTP port
+	if (checkForPacket()) {
+
+		startSession();
+	}
+
+	// give every transfer a chance to do some work, starting where the last step left off
+	for (uint8_t n = 0; n < TFTP_MAX_SESSIONS; ++n) {
+
+		uint8_t i = (m_nextSession + n) % TFTP_MAX_SESSIONS;
+
+		session_t& session = m_sessions[i];
+
+		// only one transfer at a time can hold the card in a multi-block command
+		if (m_rawStream != NULL && m_rawStream != &session && (session.state == SESSION_READ || session.state == SESSION_WRITE)) stopRawStream();
+
+		if (TFTP_ENABLE_RRQ && session.state == SESSION_READ) {
+
+			serviceReadRequest (session);
+		}
+
+		else if (TFTP_ENABLE_WRQ && session.state == SESSION_WRITE) {
+
+			serviceWriteRequest (session);
+		}
+
+		else if (TFTP_ENABLE_WRQ && session.state == SESSION_DALLY) {
+
+			serviceDally (session);
+		}
+
+		else {
+
+			continue;
+		}
+
+		// out of time so the next transfer goes first next time
+		if (!budgetLeft()) {
+
+			m_nextSession = (i + 1) % TFTP_MAX_SESSIONS;
+
+			break;
+		}
+	}
+
+	// anything still going?
+	for (uint8_t i = 0; i < TFTP_MAX_SESSIONS; ++i) {
+
+		if (m_sessions[i].state != SESSION_FREE) return true;
+	}
+
+	return m_backlogCount > 0;
+}
+
+// hand the card back to the sketch
+bool TftpServer::releaseCard() {
+
+	return stopRawStream();
+}
+
+// check a socket for a packet
+bool TftpServer::receivePacket (TftpSocket& socket) {
+
+	// check for a packet
+	m_bufferCount = socket.receivePacket (m_receiveBuffer, sizeof (m_receiveBuffer));
+
+	// the buffer has data in it so we have a packet!
+	if (m_bufferCount > 0) {
+
+		// get information on the packet sender
+		m_remoteIpAddress = socket.remoteIP();
+		m_remotePort = socket.remotePort();
+
+		if (m_trace != NULL) {
+
+			TftpTrace::packet (*m_trace, m_clock->micros(), false, m_receiveBuffer, m_bufferCount, m_remoteIpAddress, m_remotePort);
+		}
+
+		// start from the beginning of the buffer
+		m_bufferPosition = 0;
+
+		return true;
+	}
+
+	// There was a UDP error, restart UDP
+	else if (m_bufferCount < 0) {
+
+		if (debugOutput()) m_log->printlnf ("***ERROR: TFTP receivePacket error %d", m_bufferCount);
+
+		// reinitialize UDP to clear the error
+		socket.begin (socket.localPort());
+
+	}
+
+	return false;
+}
+
+// every packet leaves through here
+int TftpServer::sendPacket (TftpSocket& socket, const uint8_t* packet, size_t length, uint32_t remoteIp, uint16_t remotePort) {
+
+	if (m_trace != NULL) {
+
+		TftpTrace::packet (*m_trace, m_clock->micros(), true, packet, length, remoteIp, remotePort);
+	}
+
+	return socket.sendPacket (packet, length, remoteIp, remotePort);
+}
+
+// set up a transfer for a new client
+void TftpServer::startSession() {
+
+	// start from the beginning of the buffer
+	m_bufferPosition = 0;
+
+	if (debugOutput()) m_log->print ("Handling Incoming TFTP Request... ");
+
+	// take the request apart where it lies in the receive buffer
+	bool wellFormed = m_request.parse (m_receiveBuffer, static_cast <size_t> (m_bufferCount));
+
+	// 1st 2 bytes of incoming packet are the opcode
+	m_opCode = m_request.opCode();
+
+	/// Send error for illegal TFTP operation (only RRQ and WRQ are valid for initial request)
+	if (m_opCode != RRQ && m_opCode != WRQ) {
+
+		// Send error message to originator
+		sendError (*m_tftp, ILLEGAL_OPERATION, m_errorIllegalOperation, "***ERROR: Initial Request is not RRQ or WRQ!",
+				m_remoteIpAddress, m_remotePort);
+
+		return;
+	}
+
+	// cut short or garbled, so refuse it before it takes up a session
+	if (!wellFormed) {
+
+		sendError (*m_tftp, ILLEGAL_OPERATION, m_errorIllegalOperation, "***ERROR: Malformed request!",
+				m_remoteIpAddress, m_remotePort);
+
+		return;
+	}
+
+	// the name has to fit in the session
+	if (strlen (m_request.fileName()) >= TFTP_FILE_NAME_SIZE) {
+
+		sendError (*m_tftp, NOT_DEFINED, m_errorFileNameTooLong, "***ERROR: File name too long!",
+				m_remoteIpAddress, m_remotePort);
+
+		return;
+	}
+
+	session_t* newSession = NULL;
+	session_t* dallying = NULL;
+
+	for (uint8_t i = 0; i < TFTP_MAX_SESSIONS; ++i) {
+
+		session_t& session = m_sessions[i];
+
+		// the client retransmitted its request before our first reply reached it
+		if (session.state != SESSION_FREE && session.remoteIpAddress == m_remoteIpAddress &&
+				session.remotePort == m_remotePort) {
+
+			if (debugOutput()) m_log->println ("Ignoring duplicate request");
+
+			return;
+		}
+
+		// grab the first free slot
+		if (session.state == SESSION_FREE && newSession == NULL) {
+
+			newSession = &session;
+		}
+
+		if (session.state == SESSION_DALLY && dallying == NULL) {
+
+			dallying = &session;
+		}
+	}
+
+	// a finished upload waiting for a lost ACK is worth less than a new transfer
+	if (newSession == NULL && dallying != NULL) {
+
+		endSession (*dallying);
+
+		newSession = dallying;
+	}
+
+	// the client asked again while its request was waiting, which shows it is still there
+	for (uint8_t i = 0; i < m_backlogCount; ++i) {
+
+		if (m_backlog[i].remoteIpAddress == m_remoteIpAddress && m_backlog[i].remotePort == m_remotePort) {
+
+			m_backlog[i].lastHeard = m_clock->millis();
+
+			if (debugOutput()) m_log->println ("Ignoring duplicate request");
+
+			return;
+		}
+	}
+
+	// every session is in use so wait for one if there is room
+	if (newSession == NULL && queueRequest()) {
+
+		if (debugOutput()) m_log->printlnf ("Queued (%u waiting)", m_backlogCount);
+
+		return;
+	}
+
+	// every session is in use and the backlog is full
+	if (newSession == NULL) {
+
+		sendError (*m_tftp, NOT_DEFINED, m_errorServerBusy, "***ERROR: No free TFTP sessions",
+				m_remoteIpAddress, m_remotePort);
+
+		m_stats.rejected++;
+
+		return;
+	}
+
+	session_t& session = *newSession;
+
+	// the transfer ID for the remote client is the same as their port number
+	session.remoteIpAddress = m_remoteIpAddress;
+	session.remotePort = m_remotePort;
+
+	// the file name is the only part of the request kept once it has been handled
+	strcpy (session.fileName, m_request.fileName());
+
+	// decide on the mode (OCTET or NETASCII, in any case) once so the blocks don't have to
+	if (m_request.modeIs ("octet")) session.transferMode = MODE_OCTET;
+	else if (TFTP_ENABLE_NETASCII && m_request.modeIs ("netascii")) session.transferMode = MODE_NETASCII;
+	else session.transferMode = MODE_UNSUPPORTED;
+
+	// any options (RFC 2347) follow the transfer mode
+	readOptions (session);
+
+	// fresh timing and statistics for every transfer
+	session.timeout = constrain (INITIAL_TIMEOUT, m_timeoutMin, m_timeoutMax);
+	session.rttMeasured = false;
+	session.ignoreTime = false;
+	session.numberOfRetransmissions = 0;
+
+	// nothing read yet
+	session.filePosition = 0;
+	session.cacheSlot = -1;
+	session.servingFromCache = false;
+	session.provider = NULL;
+	session.rawIo = false;
+	session.rawErased = false;
+	session.preallocated = false;
+	session.blockNumber = 0;
+	session.highestBlockSent = 0;
+	session.stats = transferStats_t();
+	session.stats.write = (m_opCode == WRQ);
+	session.startTime = m_clock->millis();
+
+	// no packet buffers borrowed
+	session.readBufferRecord.slot = -1;
+
+	for (uint8_t i = 0; i < TFTP_MAX_WINDOW_SIZE; ++i) {
+		session.window[i].slot = -1;
+	}
+
+	// reply from a port of our own which becomes our transfer ID
+	if (!openSocket (session)) {
+
+		sendError (*m_tftp, NOT_DEFINED, m_errorServerBusy, "***ERROR: Unable to open a TFTP transfer socket",
+				m_remoteIpAddress, m_remotePort);
+
+		m_stats.rejected++;
+
+		return;
+	}
+
+	// The transfer mode doesn't match anything so respond with an error.
+	if (session.transferMode == MODE_UNSUPPORTED) {
+
+		sendError (session, ILLEGAL_OPERATION, m_errorIllegalOperation, "***ERROR: Illegal TFTP Transfer Mode!");
+
+		endSession (session);
+
+		return;
+	}
+
+	// this build only serves one direction
+	if ((m_opCode == RRQ && !TFTP_ENABLE_RRQ) || (m_opCode == WRQ && !TFTP_ENABLE_WRQ)) {
+
+		sendError (session, ILLEGAL_OPERATION, m_errorIllegalOperation, "***ERROR: Request type not supported!");
+
+		endSession (session);
+
+		return;
+	}
+
+	// NETASCII indexes belong to the server while it keeps them
+	if (TFTP_ENABLE_NETASCII && m_netasciiIndex && isNetasciiIndexName (session.fileName)) {
+
+		if (m_opCode == RRQ) sendError (session, FILE_NOT_FOUND, m_errorFileNotFound, "***ERROR: File Not Found!");
+		else sendError (session, ACCESS_VIOLATION, m_errorAccessViolation, "***ERROR: NETASCII index files are reserved!");
+
+		endSession (session);
+
+		return;
+	}
+
+	// the new transfer is about to use the file system
+	stopRawStream();
+
+	/// Read Request
+	if (TFTP_ENABLE_RRQ && m_opCode == RRQ) {
+
+		m_stats.reads++;
+
+		session.state = SESSION_READ;
+
+		beginReadRequest (session);
+	}
+
+	/// Write Request
+	else if (TFTP_ENABLE_WRQ) {
+
+		m_stats.writes++;
+
+		session.state = SESSION_WRITE;
+
+		beginWriteRequest (session);
+	}
+}
+
+// wait for a free session
+bool TftpServer::queueRequest() {
+
+	if (m_backlogCount >= TFTP_REQUEST_BACKLOG || m_bufferCount > TFTP_REQUEST_SIZE) {
+
+		return false;
+	}
+
+	queuedRequest_t& request = m_backlog[m_backlogCount++];
+
+	request.remoteIpAddress = m_remoteIpAddress;
+	request.remotePort = m_remotePort;
+	request.length = m_bufferCount;
+	request.lastHeard = m_clock->millis();
+
+	memcpy (request.packet, m_receiveBuffer, m_bufferCount);
+
+	m_stats.queued++;
+
+	return true;
+}
+
+// start whatever has been waiting
+void TftpServer::admitQueuedRequests() {
+
+	uint32_t now = m_clock->millis();
+
+	// clients that stopped asking have most likely given up
+	for (uint8_t i = 0; i < m_backlogCount; ) {
+
+		if ((now - m_backlog[i].lastHeard) > BACKLOG_IDLE_TIMEOUT) {
+
+			memmove (&m_backlog[i], &m_backlog[i + 1], (m_backlogCount - i - 1) * sizeof (queuedRequest_t));
+
+			m_backlogCount--;
+			m_stats.expired++;
+		}
+
+		else {
+
+			++i;
+		}
+	}
+
+	while (m_backlogCount > 0) {
+
+		bool sessionFree = false;
+
+		for (uint8_t i = 0; i < TFTP_MAX_SESSIONS; ++i) {
+
+			if (m_sessions[i].state == SESSION_FREE || m_sessions[i].state == SESSION_DALLY) sessionFree = true;
+		}
+
+		if (!sessionFree) return;
+
+		// the oldest request goes through startSession() as if it had just arrived
+		queuedRequest_t& request = m_backlog[0];
+
+		memcpy (m_receiveBuffer, request.packet, request.length);
+
+		m_bufferCount = request.length;
+		m_remoteIpAddress = request.remoteIpAddress;
+		m_remotePort = request.remotePort;
+
+		memmove (&m_backlog[0], &m_backlog[1], (m_backlogCount - 1) * sizeof (queuedRequest_t));
+
+		m_backlogCount--;
+
+		startSession();
+	}
+}
+
+// done with this one
+void TftpServer::endSession (session_t& session) {
+
+	// a dallying upload has already been wrapped up
+	if (session.state != SESSION_DALLY) finishTransfer (session);
+
+	// give the socket back
+	m_network->closeSocket (session.socket);
+	session.socket = NULL;
+
+	session.state = SESSION_FREE;
+}
+
+// the transfer is over, one way or another
+void TftpServer::finishTransfer (session_t& session) {
+
+	transferStats_t& stats = session.stats;
+
+	stats.elapsed = m_clock->millis() - session.startTime;
+
+	// add the transfer to the totals
+	if (stats.completed) m_stats.completed++;
+	else m_stats.aborted++;
+
+	if (stats.write) m_stats.bytesReceived += stats.bytes;
+	else m_stats.bytesSent += stats.bytes;
+
+	m_stats.retransmissions += stats.retransmissions;
+	m_stats.timeouts += stats.timeouts;
+	m_stats.duplicatePackets += stats.duplicatePackets;
+	m_stats.outOfOrderPackets += stats.outOfOrderPackets;
+	m_stats.sdMicros += stats.sdMicros;
+	m_stats.throttledMicros += stats.throttledMicros;
+	m_stats.ackWaitMicros += stats.ackWaitMicros;
+
+	m_lastTransferStats = stats;
+
+	if (debugOutput())
+		m_log->printlnf ("%s %lu bytes in %lu ms.  %lu timeouts and %lu retransmissions over %lu blocks",
+			stats.completed ? "Transferred" : "Aborted after", static_cast <unsigned long> (stats.bytes),
+			static_cast <unsigned long> (stats.elapsed), static_cast <unsigned long> (stats.timeouts),
+			static_cast <unsigned long> (stats.retransmissions), static_cast <unsigned long> (stats.blocks));
+
+	if (debugOutput() && !stats.write)
+		m_log->printlnf ("Held back by pacing for %lu ms, waited %lu ms for ACKs",
+			static_cast <unsigned long> (stats.throttledMicros / 1000), static_cast <unsigned long> (stats.ackWaitMicros / 1000));
+
+	// hand the card back to the file system
+	if (m_rawStream == &session) stopRawStream();
+
+	// an unfinished contiguous file only keeps what actually arrived
+	if (session.rawIo && stats.write && !stats.completed && session.file.isOpen()) session.file.truncate (session.filePosition);
+
+	// and so does one that was created at its announced size
+	else if (session.preallocated && stats.write && !stats.completed && session.file.isOpen()) session.file.truncate (session.file.curPosition());
+
+	// close the file
+	if (session.file.isOpen()) session.file.close();
+
+	// or tell the provider the transfer is over
+	if (session.provider != NULL) session.provider->close (session.virtualFile, stats.completed);
+
+	session.provider = NULL;
+
+	// an index that didn't see the whole file is no good
+	if (session.netasciiIndex.isOpen()) session.netasciiIndex.close (m_sd, netasciiIndexName (session));
+
+	// let the cache know we are done with the file
+	if (session.cacheSlot >= 0) m_cache.release (session.cacheSlot);
+
+	session.cacheSlot = -1;
+
+	// give the packet buffers back
+	session.readBufferRecord.slot = releasePacketSlot (session.readBufferRecord.slot);
+
+	for (uint8_t i = 0; i < TFTP_MAX_WINDOW_SIZE; ++i) {
+		session.window[i].slot = releasePacketSlot (session.window[i].slot);
+	}
+}
+
+// pick a transfer ID
+bool TftpServer::openSocket (session_t& session) {
+
+	// any free port from the dynamic range will do
+	session.socket = m_network->openSocket (0);
+
+	return session.socket != NULL;
+}
+
+// adaptive timeout
+void TftpServer::updateTimeout (session_t& session) {
+
+	uint32_t sample = session.rttCalcFinish - session.rttCalcStart;
+
+	recordRtt (session, sample);
+
+	// the first measurement sets SRTT = R and RTTVAR = R/2 (RFC 6298 2.2)
+	if (!session.rttMeasured) {
+
+		session.smoothedRtt = sample << 3;
+		session.rttVariance = sample << 1;
+		session.rttMeasured = true;
+	}
+
+	// then SRTT moves 1/8 and RTTVAR 1/4 of the way towards each new sample (RFC 6298 2.3)
+	else {
+
+		int32_t delta = static_cast <int32_t> (sample) - static_cast <int32_t> (session.smoothedRtt >> 3);
+
+		session.smoothedRtt = static_cast <uint32_t> (static_cast <int32_t> (session.smoothedRtt) + delta);
+
+		if (delta < 0) delta = -delta;
+
+		session.rttVariance = session.rttVariance - (session.rttVariance >> 2) + static_cast <uint32_t> (delta);
+	}
+
+	resetTimeout (session);
+}
+
+// how long an ACK usually takes to come back, without the limits of setTimeoutRange()
+uint32_t TftpServer::roundTripTimeout (const session_t& session) const {
+
+	if (!session.rttMeasured) return session.timeout;
+
+	return (session.smoothedRtt >> 3) + (session.rttVariance >> 2) + 1;
+}
+
+// timeout from the round trip estimates, without any back-off
+void TftpServer::resetTimeout (session_t& session) {
+
+	// RTO = SRTT + max (G, 4 * RTTVAR) with a clock granularity G of 1 ms
+	session.timeout = (session.smoothedRtt >> 3) + ((session.rttVariance > 0) ? session.rttVariance : 1);
+
+	// constraining it on the low end helped with short spikes in faster networks.
+	session.timeout = constrain (session.timeout, m_timeoutMin, m_timeoutMax);
+}
+
+// round trip statistics
+void TftpServer::recordRtt (session_t& session, uint32_t sample) {
+
+	transferStats_t& stats = session.stats;
+
+	if (stats.rttSamples == 0 || sample < stats.rttMin) stats.rttMin = sample;
+	if (sample > stats.rttMax) stats.rttMax = sample;
+
+	stats.rttTotal += sample;
+	stats.rttSamples++;
+
+	// bucket n holds samples from 2^(n-1) up to 2^n ms, which is the bit length of the sample
+	uint8_t bucket = (sample == 0) ? 0 : 32 - __builtin_clz (sample);
+
+	if (bucket >= TFTP_RTT_HISTOGRAM_BUCKETS) bucket = TFTP_RTT_HISTOGRAM_BUCKETS - 1;
+
+	m_stats.rttHistogram[bucket]++;
+}
+
+// exponential back-off
+bool TftpServer::backOff (session_t& session) {
+
+	// reset the timer
+	session.resendStart = m_clock->millis();
+
+	// ignore time data for resent packets
+	session.ignoreTime = true;
+
+	// increase the transmission count for the exponential back-off
+	session.numberOfRetransmissions++;
+
+	// increase the timeout exponentially with each retransmission
+	session.timeout *= 2;
+
+	session.stats.timeouts++;
+
+	session.timeout = constrain (session.timeout, m_timeoutMin, m_timeoutMax);
+
+	// check to see if we should give up
+	return session.numberOfRetransmissions < MAX_RETRANSMISSIONS;
+}
+
+// WRQ
+void TftpServer::beginWriteRequest (session_t& session) {
+
+	if (debugOutput()) m_log->println("Write Request!");
+
+	// a generated file takes the data itself
+	if (openProvider (session)) {
+
+		if (!session.provider->openWrite (session.virtualFile)) {
+
+			session.provider = NULL;
+
+			sendError (session, ACCESS_VIOLATION, m_errorAccessViolation, "***ERROR: Provider refused the write");
+
+			endSession (session);
+
+			return;
+		}
+	}
+
+	// make sure the file does not exist
+	else if (!fileExists (session)) {
+
+		// an upload of known size goes straight to the sectors of a contiguous file,
+		// anything else to a file with the desired filename
+		if (!createRawFile (session)) {
+
+			// the client told us how big the file is so give it one contiguous run of
+			// clusters.  The file starts out that big and is cut to size at the end.
+			if (session.provider == NULL && session.transferSizeOptionAccepted && session.transferSize > 0) {
+
+				session.preallocated = session.file.createContiguous (session.fileName, session.transferSize);
+			}
+
+			if (!session.preallocated) session.file.open(session.fileName, O_CREAT | O_WRITE | O_EXCL);
+		}
+
+		// later requests find it without a scan
+		if (session.file.isOpen()) m_directory.add (session.fileName, session.file);
+
+		if (!session.file.isOpen()) {
+
+			// Send error message as an ACK that there was an issue
+			sendError (session, ACCESS_VIOLATION, m_errorAccessViolation, "TFTP file create error (SD Error)");
+
+			endSession (session);
+
+			// return
+			return;
+		}
+	}
+
+	else {
+
+		// Send error message as an ACK that file already exists
+		sendError (session, FILE_EXISTS, m_errorFileAlreadyExists, "***ERROR: File Already Exists!");
+
+		endSession (session);
+
+		return;
+	}
+
+	// the client told us how big the file is but there was no contiguous run that big
+	if (session.provider == NULL && !session.rawIo && session.transferSizeOptionAccepted && session.transferSize > 0) {
+
+		// check whether it fits at all.  Counting free clusters means reading the whole
+		// FAT so it is only done when preallocation fails.
+		if (!session.preallocated) {
+
+			int32_t freeClusters = m_sd->vol()->freeClusterCount();
+			uint64_t freeBytes = static_cast <uint64_t> (freeClusters) * m_sd->vol()->blocksPerCluster() * SD_SECTOR_SIZE;
+
+			if (freeClusters >= 0 && freeBytes < session.transferSize) {
+
+				// Send error message as an ACK that the file won't fit
+				sendError (session, DISK_FULL, m_errorDiskFull, "***ERROR: Not enough space for the file");
+
+				// don't leave an empty file behind
+				session.file.close();
+				m_sd->remove (session.fileName);
+
+				endSession (session);
+
+				return;
+			}
+		}
+	}
+
+	// start with a clean NETASCII conversion
+	session.netasciiDecoder.reset();
+
+	// nothing buffered yet
+	session.writeBufferCount = 0;
+	session.bytesSinceSync = 0;
+
+	// send an OACK if options were negotiated, otherwise an ACK that the write request is accepted
+	if (session.optionAckRequired) {
+
+		sendOptionAck (session);
+	}
+
+	else {
+
+		sendAck (session, 0);
+	}
+
+	// start the clock for calculating round trip time
+	session.rttCalcStart = m_clock->millis();
+	session.resendStart = session.rttCalcStart;
+
+	// 1st data packet should be block 1
+	session.blockNumber = 1;
+}
+
+void TftpServer::serviceWriteRequest (session_t& session) {
+
+	uint16_t packetsHandled = 0;
+
+	// handle every packet that is waiting for this transfer (or as many as there is time for)
+	while (session.state == SESSION_WRITE && (packetsHandled++ == 0 || budgetLeft()) &&
+			receivePacket (*session.socket)) {
+
+		// verify the message came from someone we expect
+		if (m_remotePort != session.remotePort || m_remoteIpAddress != session.remoteIpAddress) {
+
+			// Send error message to the unknown sender that this transfer ID is invalid
+			// don't kill the connection for this type of error
+			sendError (*session.socket, UNKNOWN_ID, m_errorUnknownTransferId, "***ERROR: Unknown Transfer ID",
+					m_remoteIpAddress, m_remotePort);
+
+			continue;
+		}
+
+		// too short to even hold an opcode and block number
+		if (m_bufferCount < 4) continue;
+
+		// 1st 2 bytes of incoming packet are the opcode
+		m_opCode = readWord();
+
+		// if this is a DATA block then get the block number and write to SD
+		if (m_opCode == DATA) {
+
+			uint16_t dataBlockNumber = readWord();
+
+			// make sure the block number matches
+			if (session.blockNumber == dataBlockNumber) {
+
+				// a block bigger than we agreed to would overrun the write buffer
+				if (m_bufferCount - 4 > session.negotiatedBlockSize) {
+
+					sendError (session, ILLEGAL_OPERATION, m_errorIllegalOperation, "***ERROR: DATA bigger than the block size!");
+
+					endSession (session);
+
+					return;
+				}
+
+				// the block answers our last ACK so it times the round trip (only if that ACK was not resent)
+				if (!session.ignoreTime) {
+
+					session.rttCalcFinish = m_clock->millis();
+
+					updateTimeout (session);
+				}
+
+				session.numberOfRetransmissions = 0;
+				session.ignoreTime = false;
+
+				// the data follows the 4 byte header
+				session.blockSize = m_bufferCount - 4;
+
+				session.stats.blocks++;
+				session.stats.bytes += session.blockSize;
+
+				// check to see if this is the last data packet
+				bool finalBlock = session.blockSize < session.negotiatedBlockSize;
+
+				uint32_t sdStart = m_clock->micros();
+
+				// hand the block to the SD card (or the write-behind buffer)
+				bool stored = storeBlock (session, finalBlock);
+
+				session.stats.sdMicros += m_clock->micros() - sdStart;
+
+				if (!stored) {
+
+					// Send error message as an ACK that there was an issue
+					sendError (session, ACCESS_VIOLATION, m_errorAccessViolation, "TFTP file write error (SD Error)");
+
+					endSession (session);
+
+					// return
+					return;
+				}
+
+				// ACK the block just stored
+				sendAck (session, session.blockNumber++);
+
+				// start the clock for calculating round trip time
+				session.rttCalcStart = m_clock->millis();
+				session.resendStart = session.rttCalcStart;
+
+				if (finalBlock) {
+
+					session.stats.completed = true;
+
+					// stay around in case the ACK gets lost
+					beginDally (session);
+
+					return;
+				}
+
+				sdStart = m_clock->micros();
+
+				// write out what has piled up while the client sends the next block
+				stored = flushWriteBuffer (session, false);
+
+				session.stats.sdMicros += m_clock->micros() - sdStart;
+
+				if (!stored) {
+
+					// Send error message that there was an issue
+					sendError (session, ACCESS_VIOLATION, m_errorAccessViolation, "TFTP file write error (SD Error)");
+
+					endSession (session);
+
+					// return
+					return;
+				}
+			}
+
+			else {
+
+				// Ignore this packet.  The block number doesn't match so it might be a duplicate packet
+				// or one that overtook a block that is still on its way
+				if (static_cast <uint16_t> (session.blockNumber - dataBlockNumber) < 0x8000) {
+
+					session.stats.duplicatePackets++;
+
+					// the client sent the last block again because our ACK got lost.  Say it
+					// again now instead of when the timer runs out, and restart the timer so
+					// it isn't said twice.
+					if (session.stats.blocks > 0 && dataBlockNumber == static_cast <uint16_t> (session.blockNumber - 1)) {
+
+						if (debugOutput()) m_log->printlnf ("Block %u again, resending its ACK", dataBlockNumber);
+
+						session.stats.retransmissions++;
+
+						sendAck (session, dataBlockNumber);
+
+						session.resendStart = m_clock->millis();
+						session.ignoreTime = true;
+					}
+				}
+
+				else {
+
+					session.stats.outOfOrderPackets++;
+				}
+			}
+		}
+
+		// the client gave up (or refused our OACK) so stop the transfer
+		else if (m_opCode == ERROR) {
+
+			if (debugOutput()) m_log->println ("***ERROR: Client aborted the transfer");
+
+			endSession (session);
+		}
+
+		// this is not a DATA packet and one was expected so ignore it
+		else {
+
+			if (debugOutput()) m_log->println ("***ERROR: Received something other than DATA");
+		}
+	}
+
+	// the next block is late so either it or our ACK got lost
+	if (session.state == SESSION_WRITE && (m_clock->millis() - session.resendStart) > session.timeout) {
+
+		if (debugOutput()) m_log->printlnf ("***ERROR: Timeout (%lu ms).  Waiting on block %u\t RTT: %lu ms",
+				static_cast <unsigned long> (session.timeout), session.blockNumber,
+				static_cast <unsigned long> (session.smoothedRtt >> 3));
+
+		// wait longer next time and check to see if we should give up
+		if (!backOff (session)) {
+
+			// tell the client we are not getting along
+			sendError (session, NOT_DEFINED, m_errorTimeoutOnReceive, "***ERROR: Timeout on Receive");
+
+			// get us out of here.
+			endSession (session);
+
+			return;
+		}
+
+		session.stats.retransmissions++;
+
+		// say the last thing again
+		if (session.blockNumber == 1 && session.optionAckRequired) {
+
+			sendOptionAck (session);
+		}
+
+		else {
+
+			sendAck (session, session.blockNumber - 1);
+		}
+	}
+}
+
+// the final ACK is out
+void TftpServer::beginDally (session_t& session) {
+
+	if (TFTP_FINAL_ACK_DALLY == 0) {
+
+		endSession (session);
+
+		return;
+	}
+
+	// the transfer is done as far as anyone else is concerned
+	finishTransfer (session);
+
+	// the dally period starts with the final ACK
+	session.resendStart = m_clock->millis();
+
+	session.state = SESSION_DALLY;
+}
+
+void TftpServer::serviceDally (session_t& session) {
+
+	while (session.state == SESSION_DALLY && receivePacket (*session.socket)) {
+
+		// verify the message came from someone we expect
+		if (m_remotePort != session.remotePort || m_remoteIpAddress != session.remoteIpAddress) {
+
+			sendError (*session.socket, UNKNOWN_ID, m_errorUnknownTransferId, "***ERROR: Unknown Transfer ID",
+					m_remoteIpAddress, m_remotePort);
+
+			continue;
+		}
+
+		// too short to even hold an opcode and block number
+		if (m_bufferCount < 4) continue;
+
+		m_opCode = readWord();
+
+		// the final ACK got lost and the client sent the last block again
+		if (m_opCode == DATA && readWord() == static_cast <uint16_t> (session.blockNumber - 1)) {
+
+			if (debugOutput()) m_log->println ("Last block again, resending the final ACK");
+
+			m_stats.retransmissions++;
+
+			sendAck (session, session.blockNumber - 1);
+		}
+	}
+
+	// the client has had its chance to send the last block again
+	if (session.state == SESSION_DALLY && (m_clock->millis() - session.resendStart) > TFTP_FINAL_ACK_DALLY) {
+
+		endSession (session);
+	}
+}
+
+// save a block that just arrived
+bool TftpServer::storeBlock (session_t& session, bool finalBlock) {
+
+	// turn NETASCII back into file data before it goes anywhere
+	if (isNetascii (session)) {
+
+		session.blockSize = session.netasciiDecoder.decode (&m_receiveBuffer[4], session.blockSize);
+	}
+
+	// generated files hand every block to their provider
+	if (session.provider != NULL) {
+
+		bool stored = session.provider->write (session.virtualFile, session.filePosition, &m_receiveBuffer[4], session.blockSize);
+
+		session.filePosition += session.blockSize;
+
+		return stored;
+	}
+
+	// a client that sends more than it announced has filled the sectors reserved for it, so
+	// the rest goes through the file system after what was streamed so far
+	if (session.rawIo && session.filePosition + session.blockSize > session.transferSize) {
+
+		if (!stopRawStream() || !session.file.seekSet (session.filePosition)) {
+
+			return false;
+		}
+
+		session.rawIo = false;
+
+		// the file is still cut to the size that arrived at the end
+		session.preallocated = true;
+
+		if (debugOutput()) m_log->println("Upload is bigger than announced, writing through the file system");
+	}
+
+	// contiguous files skip the file system
+	if (session.rawIo) {
+
+		return storeRawBlock (session, finalBlock);
+	}
+
+	// every block goes straight to the card and is synced before it is ACKed
+	if (m_durability == SYNC_EVERY_BLOCK) {
+
+		// write the file starting from the 5th byte in the buffer
+		if (session.file.write (&m_receiveBuffer[4], session.blockSize) != session.blockSize) {
+
+			return false;
+		}
+
+		// force data to be written to SD
+		return finalBlock ? finishFile (session) : session.file.sync();
+	}
+
+	// serviceWriteRequest() refuses blocks bigger than negotiated so they always fit
+	if (session.writeBufferCount + session.blockSize > TFTP_WRITE_BUFFER_SIZE) {
+
+		return false;
+	}
+
+	// otherwise collect the block in RAM with the ones before it
+	memcpy (&session.writeBuffer[session.writeBufferCount], &m_receiveBuffer[4], session.blockSize);
+	session.writeBufferCount += session.blockSize;
+
+	// the whole file has to be on the card before the last block is ACKed
+	if (finalBlock) {
+
+		return flushWriteBuffer (session, true) && finishFile (session);
+	}
+
+	return true;
+}
+
+// the upload is complete
+bool TftpServer::finishFile (session_t& session) {
+
+	// clusters preallocated past the end of the file go back to the free list
+	if (session.preallocated && !session.file.truncate (session.file.curPosition())) {
+
+		return false;
+	}
+
+	// force data to be written to SD
+	if (!session.file.sync()) {
+
+		return false;
+	}
+
+	// any cached copy of an older file with this name is out of date
+	m_cache.invalidate (session.fileName);
+
+	// and so is its NETASCII index, if there is one
+	if (TFTP_ENABLE_NETASCII && m_netasciiIndex) m_sd->remove (netasciiIndexName (session));
+
+	return true;
+}
+
+// the fast path for big uploads
+bool TftpServer::createRawFile (session_t& session) {
+
+	// blocks have to fill whole sectors and the size has to be known to reserve them
+	if (!TFTP_ENABLE_RAW_SD || m_durability == SYNC_EVERY_BLOCK || isNetascii (session) ||
+			!session.transferSizeOptionAccepted || session.transferSize == 0 ||
+			session.negotiatedBlockSize % SD_SECTOR_SIZE != 0) {
+
+		return false;
+	}
+
+	if (session.file.createContiguous (session.fileName, session.transferSize) &&
+			session.file.contiguousRange (&session.rawFirstSector, &session.rawLastSector)) {
+
+		session.rawIo = true;
+
+		if (debugOutput()) m_log->println("Writing straight to contiguous sectors");
+
+		return true;
+	}
+
+	// no contiguous run that big, the normal path sorts out whether it fits at all
+	if (session.file.isOpen()) session.file.close();
+
+	if (m_sd->exists (session.fileName)) m_sd->remove (session.fileName);
+
+	return false;
+}
+
+bool TftpServer::storeRawBlock (session_t& session, bool finalBlock) {
+
+	uint32_t sector = session.rawFirstSector + session.filePosition / SD_SECTOR_SIZE;
+	uint16_t sectors = (session.blockSize + SD_SECTOR_SIZE - 1) / SD_SECTOR_SIZE;
+
+	// storeBlock() keeps blocks past the announced size off the raw path
+	if (sectors > 0 && !startRawStream (session, sector, true)) {
+
+		return false;
+	}
+
+	// every sector of the block goes out in the same multi-block write
+	for (uint16_t i = 0; i < sectors; ++i) {
+
+		const uint8_t* data = &m_receiveBuffer[4 + i * SD_SECTOR_SIZE];
+		size_t length = session.blockSize - i * SD_SECTOR_SIZE;
+
+		// the short end of the last block is padded, the file size is fixed up below
+		if (length < SD_SECTOR_SIZE) {
+
+			memcpy (session.writeBuffer, data, length);
+			memset (&session.writeBuffer[length], 0, SD_SECTOR_SIZE - length);
+
+			data = session.writeBuffer;
+		}
+
+		if (!m_sd->card()->writeData (data)) {
+
+			return false;
+		}
+
+		m_rawNextSector++;
+	}
+
+	session.filePosition += session.blockSize;
+
+	if (!finalBlock) {
+
+		return true;
+	}
+
+	// back to the file system to give the file its real size
+	return stopRawStream() && session.file.truncate (session.filePosition) && finishFile (session);
+}
+
+// the fast path for big downloads
+void TftpServer::openRawFile (session_t& session) {
+
+	// blocks have to be whole sectors and a single block isn't worth it
+	if (!TFTP_ENABLE_RAW_SD || isNetascii (session) || session.negotiatedBlockSize % SD_SECTOR_SIZE != 0 ||
+			session.transferSize <= session.negotiatedBlockSize) {
+
+		return;
+	}
+
+	// fragmented files stay on the normal path
+	if (session.file.contiguousRange (&session.rawFirstSector, &session.rawLastSector)) {
+
+		session.rawIo = true;
+
+		if (debugOutput()) m_log->println("Reading straight from contiguous sectors");
+	}
+}
+
+int TftpServer::readRawSectors (session_t& session, uint8_t* buffer, size_t count) {
+
+	if (session.filePosition >= session.transferSize) {
+
+		return 0;
+	}
+
+	if (count > session.transferSize - session.filePosition) {
+
+		count = session.transferSize - session.filePosition;
+	}
+
+	uint32_t sector = session.rawFirstSector + session.filePosition / SD_SECTOR_SIZE;
+	uint16_t sectors = (count + SD_SECTOR_SIZE - 1) / SD_SECTOR_SIZE;
+
+	if (!startRawStream (session, sector, false)) {
+
+		return -1;
+	}
+
+	// the last sector of the file is read whole, the packet has room for it since
+	// blocks are a multiple of the sector size
+	for (uint16_t i = 0; i < sectors; ++i) {
+
+		if (!m_sd->card()->readData (&buffer[i * SD_SECTOR_SIZE])) {
+
+			// the stream is in an unknown state so start it over next time
+			stopRawStream();
+
+			return -1;
+		}
+
+		m_rawNextSector++;
+	}
+
+	return static_cast <int> (count);
+}
+
+bool TftpServer::startRawStream (session_t& session, uint32_t sector, bool write) {
+
+	// already streaming to the right place
+	if (m_rawStream == &session && m_rawWriting == write && m_rawNextSector == sector) {
+
+		return true;
+	}
+
+	if (!stopRawStream()) {
+
+		return false;
+	}
+
+	// SdFat must not hold on to a sector it would write back over the stream later
+	if (m_sd->vol()->cacheClear() == NULL) {
+
+		return false;
+	}
+
+	bool started;
+
+	// the rest of the file is pre-erased once, a stream that was interrupted just picks up again
+	if (write && !session.rawErased) {
+
+		started = m_sd->card()->writeStart (sector, session.rawLastSector + 1 - sector);
+
+		session.rawErased = true;
+	}
+
+	else {
+
+		started = write ? m_sd->card()->writeStart (sector) : m_sd->card()->readStart (sector);
+	}
+
+	if (!started) {
+
+		return false;
+	}
+
+	m_rawStream = &session;
+	m_rawWriting = write;
+	m_rawNextSector = sector;
+
+	return true;
+}
+
+bool TftpServer::stopRawStream() {
+
+	if (m_rawStream == NULL) return true;
+
+	bool stopped = m_rawWriting ? m_sd->card()->writeStop() : m_sd->card()->readStop();
+
+	m_rawStream = NULL;
+
+	return stopped;
+}
+
+// write-behind
+bool TftpServer::flushWriteBuffer (session_t& session, bool flushAll) {
+
+	// nothing is buffered for a provider or a contiguous file
+	if (session.provider != NULL || session.rawIo) return true;
+
+	uint16_t length = session.writeBufferCount;
+
+	if (!flushAll) {
+
+		// keep collecting until the next block won't fit
+		if (TFTP_WRITE_BUFFER_SIZE - length >= session.negotiatedBlockSize) {
+
+			return true;
+		}
+
+		// only write whole sectors so the file stays sector aligned and SdFat
+		// doesn't have to read a sector back in to finish it later
+		length -= length % SD_SECTOR_SIZE;
+	}
+
+	if (length > 0 && session.file.write (session.writeBuffer, length) != length) {
+
+		return false;
+	}
+
+	// move the partial sector that is left over to the front of the buffer
+	session.writeBufferCount -= length;
+	memmove (session.writeBuffer, &session.writeBuffer[length], session.writeBufferCount);
+
+	// sync once enough data has been written
+	session.bytesSinceSync += length;
+
+	if (m_durability == SYNC_EVERY_INTERVAL && session.bytesSinceSync >= m_syncInterval) {
+
+		session.bytesSinceSync = 0;
+
+		return session.file.sync();
+	}
+
+	return true;
+}
+
+// RRQ
+void TftpServer::beginReadRequest (session_t& session) {
+
+	if (debugOutput()) m_log->println("Read Request!");
+
+	// a generated file comes from its provider
+	if (openProvider (session)) {
+
+		if (!session.provider->openRead (session.virtualFile)) {
+
+			session.provider = NULL;
+
+			sendError (session, FILE_NOT_FOUND, m_errorFileNotFound, "***ERROR: Provider has no such file!");
+
+			endSession (session);
+
+			return;
+		}
+
+		session.transferSize = session.virtualFile.size;
+
+		// nothing to tell a client that asked how big it is
+		if (session.transferSize == TFTP_UNKNOWN_SIZE) {
+
+			session.transferSizeOptionAccepted = false;
+			session.optionAckRequired = session.blockSizeOptionAccepted || session.windowSizeOptionAccepted;
+		}
+	}
+
+	// open the requested file if it exists
+	else if (openFile (session)) {
+
+		if (!session.file.isOpen()) {
+
+			// Send error message as an ACK that there was an issue
+			sendError (session, ACCESS_VIOLATION, m_errorAccessViolation, "TFTP file open error (SD Error)");
+
+			endSession (session);
+
+			// return
+			return;
+		}
+
+		// the client asked how big the file is
+		session.transferSize = session.file.fileSize();
+
+		// the modification time tells whether a cached copy is still good
+		dir_t directoryEntry;
+		uint32_t modified = 0;
+
+		if (session.file.dirEntry (&directoryEntry)) {
+
+			modified = (static_cast <uint32_t> (directoryEntry.lastWriteDate) << 16) | directoryEntry.lastWriteTime;
+		}
+
+		// send an up to date copy from RAM if there is one
+		session.cacheSlot = m_cache.find (session.fileName, session.transferSize, modified);
+
+		if (session.cacheSlot >= 0) {
+
+			session.servingFromCache = true;
+
+			m_stats.cacheHits++;
+
+			session.file.close();
+		}
+
+		// otherwise copy the file into the cache on the way out if it is small enough
+		else {
+
+			session.cacheSlot = m_cache.reserve (session.fileName, session.transferSize, modified);
+
+			// and read it straight from its sectors if they are all in one run
+			openRawFile (session);
+		}
+
+		// text files get a block index so a later RRQ can seek to any block and knows the size on the wire
+		if (isNetascii (session) && m_netasciiIndex) {
+
+			beginNetasciiIndex (session, modified);
+		}
+	}
+
+	// Error: file does not exist
+	else {
+
+		// Send error message as an ACK
+		sendError (session, FILE_NOT_FOUND, m_errorFileNotFound, "***ERROR: File Not Found!");
+
+		endSession (session);
+
+		return;
+	}
+
+	// initialize variables
+	session.throttled = false;
+	session.awaitingAck = false;
+	session.waitSince = m_clock->micros();
+	session.blockReady = false;
+	session.transferComplete = false;
+	session.ignoreTime = false;
+	session.lastAckedBlock = 0;
+	session.blocksInFlight = 0;
+	session.windowStart = 0;
+	session.rollbackTime = m_clock->millis();
+	session.partialAck = false;
+
+	// start with a clean NETASCII conversion
+	session.netasciiEncoder.reset();
+
+	// negotiated options are confirmed with an OACK which the client answers with ACK 0
+	session.waitingForOptionAck = session.optionAckRequired;
+
+	if (session.waitingForOptionAck) {
+
+		sendOptionAck (session);
+
+		// start the clock for calculating round trip time
+		session.rttCalcStart = m_clock->millis();
+		session.resendStart = session.rttCalcStart;
+		session.numberOfRetransmissions = 0;
+	}
+}
+
+void TftpServer::serviceReadRequest (session_t& session) {
+
+	// the time since the last call went to whatever held the transfer up at its end
+	uint32_t now = m_clock->micros();
+
+	if (session.throttled) session.stats.throttledMicros += now - session.waitSince;
+	else if (session.awaitingAck) session.stats.ackWaitMicros += now - session.waitSince;
+
+	session.waitSince = now;
+
+	bool progress = true;
+
+	// keep going as long as there is something to do right now
+	while (progress && session.state == SESSION_READ) {
+
+		progress = false;
+
+		// an ACK short of the end of the window and the block after it has been out for longer
+		// than a round trip, so the client lost it and has been dropping the rest since (RFC 7440)
+		if (session.partialAck && (m_clock->millis() - session.window [session.windowStart].sentTime) > roundTripTimeout (session)) {
+
+			rollBackWindow (session);
+
+			progress = true;
+		}
+
+		// keep sending until the window is full or the last block is out (and pacing lets us)
+		else if (!session.waitingForOptionAck && !session.transferComplete &&
+				session.blocksInFlight < session.negotiatedWindowSize && paceAllows (4 + session.negotiatedBlockSize)) {
+
+			blockRecord_t& record = session.window [(session.windowStart + session.blocksInFlight) % TFTP_MAX_WINDOW_SIZE];
+
+			// blocks up to the highest one sent so far are retransmits, the rest are new
+			bool resend = static_cast <uint16_t> (session.highestBlockSent - session.blockNumber - 1) < 0x8000;
+
+			// a block still in its packet buffer goes out again as it is
+			if (resend && record.slot >= 0) {
+
+				session.blockSize = record.length;
+			}
+
+			else {
+
+				// the block has to come from the file again
+				if (resend) {
+
+					rewindToBlock (session, (session.windowStart + session.blocksInFlight) % TFTP_MAX_WINDOW_SIZE);
+				}
+
+				// read the next block from the file unless it was already read ahead
+				if (!session.blockReady && !readBlock (session)) {
+
+					// Send error message as an ACK that there was an issue
+					sendError (session, ACCESS_VIOLATION, m_errorAccessViolation, "TFTP File Read Error (SD Error)");
+
+					endSession (session);
+
+					// return
+					return;
+				}
+
+				// the window keeps the packet (and where it starts in the file) until it is ACKed
+				releasePacketSlot (record.slot);
+
+				record = session.readBufferRecord;
+
+				session.readBufferRecord.slot = -1;
+				session.blockReady = false;
+
+				// a block read ahead (or a retransmit just sent) left another length behind
+				session.blockSize = record.length;
+			}
+
+			// check for EOF
+			if (session.blockSize < session.negotiatedBlockSize) {
+
+				// Reached end of file
+				session.transferComplete = true;
+			}
 
-	m_localPort = portNumber;
+			// increment the file block number
+			session.blockNumber++;
+			session.blocksInFlight++;
 
-	// ensure that WiFi is running before trying to start UDP
-	if (!WiFi.ready()) {
+			if (resend) {
 
-		WiFi.connect();
+				session.stats.retransmissions++;
+			}
 
-		waitUntil (WiFi.ready);
-	}
+			else {
 
-	// start UDP at the specified port number
-	m_tftp.begin (m_localPort);
+				session.highestBlockSent = session.blockNumber;
+				session.stats.blocks++;
+				session.stats.bytes += session.blockSize;
 
-	// pointers to the file system from main application
-	m_sd = sd;
+				// new blocks go into the NETASCII index in order
+				if (session.netasciiIndex.isBuilding() && !session.netasciiIndex.add (record.filePosition, record.netasciiState)) {
 
-	// Send errors and timeout messages to Serial
-	m_serialDebug = serialDebug;
+					if (debugOutput()) m_log->printlnf ("***ERROR: Unable to write %s", netasciiIndexName (session));
 
-	return true;
-}
+					session.netasciiIndex.close (m_sd, netasciiIndexName (session));
+				}
+			}
 
-// shut it down
-void TftpServer::stop() {
+			// send the data packet
+			sendDataPacket (session, record.slot);
 
-	m_tftp.stop();
+			record.sentTime = m_clock->millis();
 
-	if (m_file.isOpen()) m_file.close();
-}
+			// start the clock for calculating round trip time
+			session.rttCalcStart = m_clock->millis();
+			session.resendStart = session.rttCalcStart;
 
-bool TftpServer::checkForPacket() {
+			progress = true;
+		}
 
-	// check for a packet
-	m_bufferCount = m_tftp.receivePacket (udpBuffer, UDP_BUFFER_SIZE);
+		// check for a new UDP message (looking for an ACK)
+		else if (receivePacket (*session.socket)) {
 
-	// the buffer has data in it so we have a packet!
-	if (m_bufferCount > 0) {
+			handleReadResponse (session);
 
-		// get information on the packet sender
-		m_remoteIpAddress = m_tftp.remoteIP();
-		m_remotePort = m_tftp.remotePort();
+			progress = true;
+		}
 
-		return true;
-	}
+		// read the next block while the client works on its ACK so it can go out as soon as the ACK arrives
+		else if (!session.blockReady && !session.transferComplete) {
 
-	// There was a UDP error, restart UDP
-	else if (m_bufferCount < 0) {
+			if (!readBlock (session)) {
 
-		if (m_serialDebug) Serial.printlnf ("***ERROR: TFTP receivePacket error %d", m_bufferCount);
+				// Send error message as an ACK that there was an issue
+				sendError (session, ACCESS_VIOLATION, m_errorAccessViolation, "TFTP File Read Error (SD Error)");
 
-		// reinitialize UDP to clear the error
-		m_tftp.begin (m_localPort);
+				endSession (session);
 
+				// return
+				return;
+			}
+
+			progress = true;
+		}
+
+		// check to see if we should re-send the last data packet
+		else if ((m_clock->millis() - session.resendStart) > session.timeout) {
+
+			if (debugOutput()) m_log->printlnf ("***ERROR: Timeout (%lu ms).  Re-sending from block %u\t RTT: %lu ms",
+					static_cast <unsigned long> (session.timeout), static_cast <uint16_t> (session.lastAckedBlock + 1),
+					static_cast <unsigned long> (session.smoothedRtt >> 3));
+
+			// send the OACK again if that is what we are waiting on
+			if (session.waitingForOptionAck) {
+
+				sendOptionAck (session);
+
+				session.stats.retransmissions++;
+			}
+
+			// otherwise go back to the first unacknowledged block and send the window again
+			else {
+
+				session.blockNumber = session.lastAckedBlock;
+				session.blocksInFlight = 0;
+				session.transferComplete = false;
+				session.rollbackTime = m_clock->millis();
+				session.partialAck = false;
+
+				progress = true;
+			}
+
+			// wait longer next time and check to see if we should give up
+			if (!backOff (session)) {
+
+				// tell the client we are not getting along
+				sendError (session, NOT_DEFINED, m_errorTimeoutOnSend, "***ERROR: Timeout on Send");
+
+				// get us out of here.
+				endSession (session);
+			}
+		}
+
+		// leave the rest for the next step
+		if (!budgetLeft()) break;
 	}
 
-	return false;
+	// held back if there is room in the window but not in the pacing bucket
+	bool windowOpen = !session.waitingForOptionAck && !session.transferComplete &&
+			session.blocksInFlight < session.negotiatedWindowSize;
+
+	session.throttled = windowOpen && m_paceRate > 0 && m_paceTokens < 4U + session.negotiatedBlockSize;
+	session.awaitingAck = !windowOpen;
 }
 
-// Take care of all your client's needs!
-void TftpServer::processRequest() {
+// look at what the client sent back
+void TftpServer::handleReadResponse (session_t& session) {
 
-	m_timeout = INITIAL_TIMEOUT;
-	m_rtt = INITIAL_TIMEOUT;
+	// verify the message came from someone we expect
+	if (m_remotePort != session.remotePort || m_remoteIpAddress != session.remoteIpAddress) {
 
-	// start from the beginning of the buffer
-	m_bufferPosition = 0;
+		// Send error message to the unknown sender that this transfer ID is invalid
+		// don't kill the connection for this type of error
+		sendError (*session.socket, UNKNOWN_ID, m_errorUnknownTransferId, "***ERROR: Unknown Transfer ID",
+				m_remoteIpAddress, m_remotePort);
+
+		return;
+	}
 
-	if (m_serialDebug) Serial.print ("Handling Incoming TFTP Request... ");
+	// too short to even hold an opcode and block number
+	if (m_bufferCount < 4) return;
 
 	// 1st 2 bytes of incoming packet are the opcode
 	m_opCode = readWord();
 
-	/// Read Request
-	if (m_opCode == RRQ) {
+	// if this is an ACK then get the block number
+	if (m_opCode == ACK) {
 
-		handleReadRequest();
-	}
+		// ACK block number is the next 2 bytes
+		uint16_t ackBlockNumber = readWord();
 
-	/// Write Request
-	else if (m_opCode == WRQ) {
+		// ACK 0 accepts our OACK so the first block can go out
+		if (session.waitingForOptionAck) {
 
-		handleWriteRequest();
-	}
+			if (ackBlockNumber == 0) {
 
-	/// Send error for illegal TFTP operation (only RRQ and WRQ are valid for initial request)
-	else {
+				if (!session.ignoreTime) {
 
-		if (m_serialDebug) Serial.println ("***ERROR: Initial Request is not RRQ or WRQ!");
+					session.rttCalcFinish = m_clock->millis();
 
-		// Send error message to originator
-		sendError (ILLEGAL_OPERATION, m_errorIllegalOperation, "***ERROR: Initial Request is not RRQ or WRQ!");
-	}
+					updateTimeout (session);
+				}
 
-	if (m_serialDebug)
-		Serial.printlnf ("Timed out on %u packets out of %d total blocks (%.3f %%)",
-			m_droppedPacket, m_blockNumber,	static_cast<float> (m_droppedPacket) / static_cast<float>(m_blockNumber) * 100.0);
-}
+				session.waitingForOptionAck = false;
+				session.numberOfRetransmissions = 0;
+				session.ignoreTime = false;
+			}
 
-// adaptive timeout
-void TftpServer::updateTimeout() {
+			return;
+		}
 
-	// update the RTT based on network conditions
-	m_rtt = m_rtt * 0.9 + (m_rttCalcFinish - m_rttCalcStart) * 0.1;
+		// number of blocks this ACK covers (block numbers wrap around at 65535)
+		uint16_t blocksAcked = ackBlockNumber - session.lastAckedBlock;
 
-	// add some head room to the current average for some allowance in varying conditions
-	m_timeout = 2 * m_rtt;
+		// check to see if we got an ACK for a block in the window.
+		// ACKs for earlier blocks are duplicates and are ignored
+		// to prevent Sorcerer's Apprentice Syndrome.
+		if (blocksAcked > 0 && blocksAcked <= session.blocksInFlight) {
 
-	// constraining it on the low end helped with short spikes in faster networks.
-	m_timeout = constrain (m_timeout, TIMEOUT_MIN, TIMEOUT_MAX);
-}
+			// stop the RTT clock because we got an ACK (only if it's the 1st one)
+			if (!session.ignoreTime && ackBlockNumber == session.blockNumber) {
 
-// WRQ
-void TftpServer::handleWriteRequest() {
+				session.rttCalcFinish = m_clock->millis();
 
-	if (m_serialDebug) Serial.println("Write Request!");
+				// keep updating timeout based on current network conditions
+				updateTimeout (session);
+			}
 
-	// the transfer ID for the remote client is the same as their port number
-	m_transferId = m_remotePort;
+			// the client has these blocks so their packets can go
+			for (uint16_t i = 0; i < blocksAcked; ++i) {
 
-	// initialize variables
-	bool transferComplete = false;
+				blockRecord_t& record = session.window [(session.windowStart + i) % TFTP_MAX_WINDOW_SIZE];
 
-	// let's track dropped packets if we are debugging
-	if (m_serialDebug) m_droppedPacket = 0;
+				record.slot = releasePacketSlot (record.slot);
+			}
 
-	// Read the file name requested
-	readText (m_fileName);
+			// slide the window past everything the client has, the blocks after it are
+			// still on their way and new ones can follow them (RFC 7440 section 4)
+			session.lastAckedBlock = ackBlockNumber;
+			session.windowStart = (session.windowStart + blocksAcked) % TFTP_MAX_WINDOW_SIZE;
+			session.blocksInFlight -= blocksAcked;
 
-	// Read the desired transfer mode (OCTET or NETASCII)
-	readText (m_transferMode);
+			// the rest of the window should be ACKed within a round trip of being sent
+			session.partialAck = session.blocksInFlight > 0;
 
-	// convert transfer mode to all caps
-	for (uint8_t i = 0; i < 10; ++i) {
-		m_transferMode[i] = toupper (m_transferMode[i]);
-	}
+			// the client is taking new blocks again so the back-off is over
+			if (session.numberOfRetransmissions > 0 && session.rttMeasured) resetTimeout (session);
 
-	// make sure the file does not exist
-	if (!m_sd->exists (m_fileName.c_str())) {
+			session.numberOfRetransmissions = 0;
+			session.ignoreTime = false;
 
-		// Open a file with the desired filename
-		m_file.open(m_fileName.c_str(), O_CREAT | O_WRITE);
+			// this is the ACK for the EOF!
+			if (session.transferComplete && session.blocksInFlight == 0) {
 
-		if (!m_file.isOpen()) {
+				session.stats.completed = true;
 
-			// Send error message as an ACK that there was an issue
-			sendError (ACCESS_VIOLATION, m_errorAccessViolation, "TFTP file create error (SD Error)");
+				// the index now covers the whole file
+				if (session.netasciiIndex.isBuilding() && !session.netasciiIndex.finish (session.stats.bytes)) {
 
-			// close the file
-			m_file.close();
+					if (debugOutput()) m_log->printlnf ("***ERROR: Unable to write %s", netasciiIndexName (session));
+				}
 
-			// return
-			return;
+				endSession (session);
+			}
+		}
+
+		// the same ACK again means the client is still missing the block after it, unless
+		// the window went back less than a timeout ago and the ACK is an answer to that
+		else if (blocksAcked == 0 && session.blocksInFlight > 0 &&
+				(m_clock->millis() - session.rollbackTime) > session.timeout) {
+
+			rollBackWindow (session);
+		}
+
+		else {
+
+			session.stats.duplicatePackets++;
 		}
 	}
 
+	// the client gave up (or refused our OACK) so stop the transfer
+	else if (m_opCode == ERROR) {
+
+		if (debugOutput()) m_log->println ("***ERROR: Client aborted the transfer");
+
+		endSession (session);
+	}
+
+	// this is not an ACK and one was expected so ignore it
 	else {
 
-		// Send error message as an ACK that file already exists
-		sendError (FILE_EXISTS, m_errorFileAlreadyExists, "***ERROR: File Already Exists!");
+		if (debugOutput()) m_log->println ("***ERROR: Received something other than ACK");
 
-		return;
 	}
+}
 
-	// send an ACK that the write request is accepted
-	sendAck(0);
+// fill the packet buffer with the next block of the file
+bool TftpServer::readBlock (session_t& session) {
 
-	// 1st data packet should be block 1
-	m_blockNumber = 1;
+	blockRecord_t& record = session.readBufferRecord;
 
-	while (!transferComplete) {
+	// remember where this block starts in the file so it can be rebuilt for a retransmit
+	record.filePosition = session.filePosition;
+	record.netasciiState = session.netasciiEncoder.state();
 
-		// check for a data packet
-		if (checkForPacket()) {
+	// the block is read straight into the packet that will carry it
+	if (record.slot < 0) record.slot = acquirePacketSlot (session);
 
-			// start from the beginning of the buffer
-			m_bufferPosition = 0;
+	if (record.slot < 0) {
 
-			// verify the message came from someone we expect
-			if (m_remotePort != m_tftp.remotePort()) {
+		return false;
+	}
 
-				// Send error message to the unknown sender that this transfer ID is invalid
-				// don't kill the connection for this type of error
-				sendError (UNKNOWN_ID, m_errorUnknownTransferId, "***ERROR: Unknown Transfer ID",
-						m_tftp.remoteIP(), m_tftp.remotePort());
-			}
+	uint8_t* block = m_packetSlots[record.slot].data;
 
-			else {
+	session.blockSize = 0;
 
-				// 1st 2 bytes of incoming packet are the opcode
-				m_opCode = readWord();
+	// Send the file as binary if OCTET mode was requested
+	if (!isNetascii (session)) {
 
-				// if this is a DATA block then get the block number and write to SD
-				if (m_opCode == DATA) {
+		// read the next block from the file (this is a binary read)
+		int bytesRead = readFile (session, block, session.negotiatedBlockSize);
 
-					// make sure the block number matches
-					if (m_blockNumber == readWord()) {
+		// verify there was a good read
+		if (bytesRead < 0) {
 
-						// check to see if this is the last data packet
-						if (m_bufferCount >= 0 && m_bufferCount < 512) {
+			return false;
+		}
 
-							transferComplete = true;
-						}
+		session.blockSize = bytesRead;
+	}
 
-						// write the file as binary if OCTET mode was requested and do nothing
-						// if NETASCII is selected (just accept the file as if it was binary)
-						if (m_transferMode.compare ("OCTET") == 0 ||
-								m_transferMode.compare ("NETASCII") == 0) {
+	// Convert the file to NVT ASCII if NETASCII mode was requested
+	else {
 
-							// write the file starting from the 5th byte in the buffer
-							if (m_file.write (&udpBuffer[4], m_bufferCount) < 0) {
+		// fill up the buffer with a full block of data or stop at EOF
+		while (session.blockSize < session.negotiatedBlockSize) {
 
-								// Send error message as an ACK that there was an issue
-								sendError (ACCESS_VIOLATION, m_errorAccessViolation, "TFTP file write error (SD Error)");
+			size_t room = session.negotiatedBlockSize - session.blockSize;
 
-								// close the file
-								m_file.close();
+			// conversion only ever adds bytes so a block never needs more file data than it has room for
+			int bytesRead = readFile (session, m_netasciiBuffer, room);
 
-								// return
-								return;
-							}
+			if (bytesRead < 0) {
 
-							else {
+				return false;
+			}
 
-								// force data to be written to SD
-								m_file.sync();
+			// end of file so write out whatever is left of the last line ending
+			if (bytesRead == 0) {
 
-								// ACK the block just written
-								sendAck (m_blockNumber++);
-							}
-						}
+				session.blockSize += session.netasciiEncoder.finish (&block[session.blockSize], room);
 
-						else {
+				break;
+			}
 
-							// Send error message as an ACK
-							sendError (ILLEGAL_OPERATION, m_errorIllegalOperation, "***ERROR: Illegal TFTP Transfer Mode!");
-						}
-					}
+			size_t consumed = 0;
 
-					else {
+			session.blockSize += session.netasciiEncoder.encode (m_netasciiBuffer, bytesRead, consumed,
+					&block[session.blockSize], room);
 
-						// Ignore this packet.  The block number doesn't match so it might be a duplicate packet
-					}
-				}
+			// the block is full so give back what didn't fit for the next block
+			if (consumed < static_cast <size_t> (bytesRead)) {
 
-				// this is not a DATA packet and one was expected so ignore it
-				else {
+				seekFile (session, session.filePosition - (bytesRead - consumed));
 
-					if (m_serialDebug) Serial.println ("***ERROR: Received something other than DATA");
-				}
+				break;
 			}
 		}
 	}
 
-	// close the file
-	m_file.close();
-}
+	// the block is sitting in its packet waiting to be sent
+	record.length = session.blockSize;
+	session.blockReady = true;
 
-// RRQ
-void TftpServer::handleReadRequest() {
+	return true;
+}
 
-	if (m_serialDebug) Serial.println("Read Request!");
+// file data for a RRQ
+int TftpServer::readFile (session_t& session, uint8_t* buffer, size_t count) {
 
-	// the transfer ID for the remote client is the same as their port number
-	m_transferId = m_remotePort;
+	int bytesRead;
 
-	// let's track dropped packets if we are debugging
-	if (m_serialDebug) m_droppedPacket = 0;
+	// generated files come from their provider
+	if (session.provider != NULL) {
 
-	// Read the file name requested
-	readText (m_fileName);
+		bytesRead = session.provider->read (session.virtualFile, session.filePosition, buffer, count);
+	}
 
-	// Read the desired transfer mode (OCTET or NETASCII)
-	readText (m_transferMode);
+	// cached files come straight out of RAM
+	else if (session.servingFromCache) {
 
-	// convert transfer mode to all caps
-	for (uint8_t i = 0; i < 10; ++i) {
-		m_transferMode[i] = toupper (m_transferMode[i]);
+		bytesRead = m_cache.read (session.cacheSlot, session.filePosition, buffer, count);
 	}
 
-	// check that the file exists
-	if (m_sd->exists (m_fileName.c_str())) {
+	else {
 
-		// open the requested file
-		m_file = m_sd->open (m_fileName.c_str(), O_READ);
+		uint32_t sdStart = m_clock->micros();
 
-		if (!m_file.isOpen()) {
+		bytesRead = session.rawIo ? readRawSectors (session, buffer, count) : session.file.read (buffer, count);
 
-			// Send error message as an ACK that there was an issue
-			sendError (ACCESS_VIOLATION, m_errorAccessViolation, "TFTP file open error (SD Error)");
+		session.stats.sdMicros += m_clock->micros() - sdStart;
 
-			// close the file
-			m_file.close();
+		// keep a copy for the next time the file is asked for
+		if (bytesRead > 0 && session.cacheSlot >= 0) {
 
-			// return
-			return;
+			m_cache.fill (session.cacheSlot, session.filePosition, buffer, bytesRead);
 		}
 	}
 
-	// Error: file does not exist
-	else {
+	if (bytesRead > 0) session.filePosition += bytesRead;
 
-		// Send error message as an ACK
-		sendError (FILE_NOT_FOUND, m_errorFileNotFound, "***ERROR: File Not Found!");
-	}
+	return bytesRead;
+}
 
-	// initialize variables
-	m_blockNumber = 0;
-	bool sendData = true;
-	bool receivedFinalAck = false;
-	bool transferComplete = false;
-	bool ignoreTime = false;
+void TftpServer::seekFile (session_t& session, uint32_t position) {
 
-	// track if we found a lone \n and didn't have enough room to insert \r
-	bool startNextPacketWithNewLine = false;
+	session.filePosition = position;
 
-	// track if we found a lone \r and didn't have enough room to insert \0
-	bool startNextPacketWithNull = false;
+	// multi-block reads find their sector from the position alone
+	if (!session.servingFromCache && session.provider == NULL && !session.rawIo) session.file.seekSet (position);
+}
 
-	// track if we found a \r\n and should not insert \r
-	bool dontInsertCarriageReturn = false;
+// find the file of a RRQ, without a directory scan if the index knows it
+bool TftpServer::openFile (session_t& session) {
 
-	// loop until the entire file is sent
-	while (!transferComplete || !receivedFinalAck) {
+	TftpDirectoryIndex::lookup_t lookup = m_directory.open (session.fileName, session.file, O_READ);
 
-		// only do these things if we are ready
-		if (sendData) {
+	if (lookup != TftpDirectoryIndex::LOOKUP_UNKNOWN) {
 
-			m_blockSize = 0;
+		return lookup == TftpDirectoryIndex::LOOKUP_FOUND;
+	}
 
-			// Send the file as binary if OCTET mode was requested
-			if (m_transferMode.compare ("OCTET") == 0) {
+	if (!m_sd->exists (session.fileName)) {
 
-				// read the next 512 byte block from the file (this is a binary read)
-				m_blockSize = m_file.read (&udpBuffer[4], 512);
+		return false;
+	}
 
-				// verify there was a good read
-				if (m_blockSize < 0) {
+	session.file.open (session.fileName, O_READ);
 
-					// Send error message as an ACK that there was an issue
-					sendError (ACCESS_VIOLATION, m_errorAccessViolation, "TFTP File Read Error (SD Error)");
+	return true;
+}
 
-					// close the file
-					m_file.close();
+bool TftpServer::fileExists (session_t& session) {
 
-					// return
-					return;
-				}
-			}
+	File file;
 
-			// Convert the file to NVT ASCII if NETASCII mode was requested
-			else if (m_transferMode.compare ("NETASCII") == 0) {
+	TftpDirectoryIndex::lookup_t lookup = m_directory.open (session.fileName, file, O_READ);
 
-				if (startNextPacketWithNewLine) {
+	if (lookup == TftpDirectoryIndex::LOOKUP_FOUND) {
 
-					// put the \n from the \r\n combo from the previous packet at the start of the packet
-					udpBuffer [4 + m_blockSize++] = '\n';
+		file.close();
 
-					// reset for the next packet
-					startNextPacketWithNewLine = false;
-				}
+		return true;
+	}
 
-				else if (startNextPacketWithNull) {
+	// the sketch may have created the file after the index was read, and an upload
+	// must never overwrite it, so a miss is checked on the card
+	if (lookup == TftpDirectoryIndex::LOOKUP_NOT_FOUND && file.open (session.fileName, O_READ)) {
 
-					// put the \n from the \r\n combo from the previous line at the start of the packet
-					udpBuffer [4 + m_blockSize++] = '\0';
+		// later requests find it without a scan
+		m_directory.add (session.fileName, file);
 
-					// reset for the next packet
-					startNextPacketWithNull = false;
-				}
+		file.close();
 
-				// fill up the buffer with 512 bytes of data or stop at EOF
-				while (m_blockSize < 512 && m_file.peek() != EOF) {
+		return true;
+	}
 
-					// grab the next character
-					uint8_t c = m_file.read();
+	return lookup == TftpDirectoryIndex::LOOKUP_UNKNOWN && m_sd->exists (session.fileName);
+}
 
-					if (c < 0) {
+// look for a provider of the requested file
+bool TftpServer::openProvider (session_t& session) {
 
-						// Send error message as an ACK that there was an issue
-						sendError (ACCESS_VIOLATION, m_errorAccessViolation, "TFTP File Read Error (SD Error)");
+	session.provider = findProvider (session.fileName);
 
-						// close the file
-						m_file.close();
+	if (session.provider == NULL) return false;
 
-						// return
-						return;
-					}
+	session.virtualFile.name = session.fileName;
+	session.virtualFile.size = (session.stats.write && session.transferSizeOptionAccepted) ? session.transferSize : 0;
+	session.virtualFile.start = 0;
+	session.virtualFile.context = NULL;
 
-					// check for a \r\n sequence so we don't insert an extra \r
-					if (c == '\r' && m_file.peek() == '\n') {
+	return true;
+}
 
-						dontInsertCarriageReturn = true;
+// find or start the block index of a text file
+void TftpServer::beginNetasciiIndex (session_t& session, uint32_t modified) {
 
-						// put the \r character into the buffer
-						udpBuffer [4 + m_blockSize++] = c;
-					}
+	uint32_t encodedSize = 0;
+
+	// a good index from an earlier transfer finds any block and tells how big the file is in NETASCII
+	if (session.netasciiIndex.load (netasciiIndexName (session), session.transferSize, modified,
+			session.negotiatedBlockSize, encodedSize)) {
 
-					// replace \n with \r\n as long as it's not already part of \r\n
-					else if (c == '\n' && !dontInsertCarriageReturn) {
+		if (session.transferSizeRequested) {
 
-						// insert the \r
-						udpBuffer [4 + m_blockSize++] = '\r';
+			session.transferSize = encodedSize;
+			session.transferSizeOptionAccepted = true;
+			session.optionAckRequired = true;
+		}
 
-						// check to see if we reached the end of the buffer
-						if (m_blockSize == 512) {
+		return;
+	}
 
-							// set so the start of the next packet buffer will be the \n
-							startNextPacketWithNewLine = true;
+	// only one transfer writes the index, and not while another one reads it
+	for (uint8_t i = 0; i < TFTP_MAX_SESSIONS; ++i) {
 
-							// get out of the loop for this packet
-							break;
-						}
+		const session_t& other = m_sessions[i];
 
-						else {
+		if (&other != &session && other.state != SESSION_FREE && other.netasciiIndex.isOpen() &&
+				strcmp (other.fileName, session.fileName) == 0) {
 
-							// we have space in the buffer so write the \n
-							udpBuffer [4 + m_blockSize++] = '\n';
-						}
-					}
+			return;
+		}
+	}
 
-					// replace lone \r with \r\0
-					else if (c == '\r' && m_file.peek() != '\n') {
+	// the old index is out of date or was never finished so start over
+	if (!session.netasciiIndex.create (m_sd, netasciiIndexName (session), session.transferSize, modified,
+			session.negotiatedBlockSize)) {
 
-						// write the \r
-						udpBuffer [4 + m_blockSize++] = '\r';
+		if (debugOutput()) m_log->printlnf ("***ERROR: Unable to create %s", netasciiIndexName (session));
+	}
+}
 
-						// check to see if we reached the end of the buffer
-						if (m_blockSize == 512) {
+const char* TftpServer::netasciiIndexName (const session_t& session) {
 
-							// set so the start of the next buffer will be the \0
-							startNextPacketWithNull = true;
+	strcpy (m_netasciiIndexName, session.fileName);
+	strcat (m_netasciiIndexName, TFTP_NETASCII_INDEX_SUFFIX);
 
-							// get out of the loop for this packet
-							break;
-						}
+	return m_netasciiIndexName;
+}
 
-						else {
+// the client missed the block after the last one it ACKed, send the window again from there
+void TftpServer::rollBackWindow (session_t& session) {
 
-							// we have space in the buffer so write the \0
-							udpBuffer [4 + m_blockSize++] = '\0';
-						}
-					}
+	if (debugOutput()) m_log->printlnf ("***ERROR: Client missed block %u.  Rolling back window",
+			static_cast <uint16_t> (session.lastAckedBlock + 1));
 
-					else {
+	session.blockNumber = session.lastAckedBlock;
+	session.blocksInFlight = 0;
+	session.transferComplete = false;
+	session.rollbackTime = m_clock->millis();
+	session.partialAck = false;
 
-						// put the next character into the buffer
-						udpBuffer [4 + m_blockSize++] = c;
-					}
-				}
-			}
+	// round trips of resent blocks can't be measured
+	session.ignoreTime = true;
 
-			// The transfer mode doesn't match anything so respond with an error.
-			else {
+	session.stats.outOfOrderPackets++;
+}
 
-				// Send error message as an ACK
-				sendError (ILLEGAL_OPERATION, m_errorIllegalOperation, "***ERROR: Illegal TFTP Transfer Mode!");
-			}
+// go back to a block that is still in the window
+void TftpServer::rewindToBlock (session_t& session, uint16_t windowIndex) {
 
-			// check for EOF
-			if (m_blockSize >= 0 && m_blockSize < 512) {
+	const blockRecord_t& record = session.window [windowIndex];
 
-				// Reached end of file
-				transferComplete = true;
-			}
+	uint16_t blocksSent = session.highestBlockSent - session.lastAckedBlock;
+	uint16_t offset = (windowIndex + TFTP_MAX_WINDOW_SIZE - session.windowStart) % TFTP_MAX_WINDOW_SIZE;
 
-			// increment the file block number
-			m_blockNumber++;
+	uint32_t filePosition = record.filePosition;
+	uint8_t netasciiState = record.netasciiState;
 
-			// send the data packet
-			sendDataPacket ();
+	// a finished NETASCII index has every block of the file (counted from 0) and leaves
+	// the window's copy alone if it can't be read
+	if (session.netasciiIndex.isLoaded()) {
 
-			// start the clock for calculating round trip time
-			m_rttCalcStart = millis();
-			m_resendStart = m_rttCalcStart;
+		session.netasciiIndex.lookup (session.stats.blocks - blocksSent + offset, filePosition, netasciiState);
+	}
 
-			// reset for the new data packet just sent out
-			m_numberOfRetransmissions = 0;
+	// put the file and the NETASCII conversion back to where the block started
+	seekFile (session, filePosition);
+	session.netasciiEncoder.restore (netasciiState);
 
-			// don't proceed with the next block until valid ACK
-			sendData = false;
+	// anything read ahead came from the old position
+	session.blockReady = false;
 
-			// reset flag so we don't ignore time
-			ignoreTime = false;
+	// and the blocks after this one have to be read again in order behind it
 
-		}
+	for (uint16_t i = offset + 1; i < blocksSent; ++i) {
 
-		// check for a new UDP message (looking for an ACK)
-		else if (checkForPacket()) {
+		blockRecord_t& later = session.window [(session.windowStart + i) % TFTP_MAX_WINDOW_SIZE];
+
+		later.slot = releasePacketSlot (later.slot);
+	}
+}
 
-			// start from the beginning of the buffer
-			m_bufferPosition = 0;
+// lend a packet buffer to a RRQ
+int8_t TftpServer::acquirePacketSlot (session_t& session) {
 
-			uint16_t ackBlockNumber = 0;
+	// the session's own buffer
+	if (!m_packetSlotUsed[session.ownSlot]) {
 
-			// verify the message came from someone we expect
-			if (m_remotePort != m_tftp.remotePort()) {
+		m_packetSlotUsed[session.ownSlot] = true;
 
-				// Send error message to the unknown sender that this transfer ID is invalid
-				// don't kill the connection for this type of error
-				sendError (UNKNOWN_ID, m_errorUnknownTransferId, "***ERROR: Unknown Transfer ID",
-						m_tftp.remoteIP(), m_tftp.remotePort());
-			}
+		return session.ownSlot;
+	}
 
-			else {
+	// one nobody else is using (the first TFTP_MAX_SESSIONS belong to the sessions)
+	for (uint8_t i = TFTP_MAX_SESSIONS; i < TFTP_PACKET_SLOTS; ++i) {
 
-				// 1st 2 bytes of incoming packet are the opcode
-				m_opCode = readWord();
+		if (!m_packetSlotUsed[i]) {
 
-				// if this is an ACK then get the block number
-				if (m_opCode == ACK) {
+			m_packetSlotUsed[i] = true;
 
-					// ACK block number is the next 2 bytes
-					ackBlockNumber = readWord();
+			return i;
+		}
+	}
 
-					// check to see if we got an ACK for the correct block
-					// Does not allow previous blocks to be re-sent since
-					// m_blockNumber is incremented as soon as data is buffered,
-					// so it should prevent Sorcerer's Apprentice Syndrome.
-					if (ackBlockNumber == m_blockNumber) {
+	// take our own buffer back from a block in the window
+	for (uint8_t i = 0; i < TFTP_MAX_WINDOW_SIZE; ++i) {
 
-						// stop the RTT clock because we got an ACK (only if it's the 1st one)
-						if (!ignoreTime) {
+		if (session.window[i].slot == session.ownSlot) {
 
-							m_rttCalcFinish = millis();
+			session.window[i].slot = -1;
 
-							// keep updating timeout based on current network conditions
-							updateTimeout();
-						}
+			return session.ownSlot;
+		}
+	}
 
-						// This is the ACK we are looking for... send the next block
-						sendData = true;
+	return -1;
+}
 
-						if (transferComplete) {
+// return a packet buffer to the pool
+int8_t TftpServer::releasePacketSlot (int8_t slot) {
 
-							// this is the ACK for the EOF!
-							receivedFinalAck = true;
-						}
-					}
-				}
+	if (slot >= 0) m_packetSlotUsed[slot] = false;
 
-				// this is not an ACK and one was expected so ignore it
-				else {
+	return -1;
+}
 
-					if (m_serialDebug) Serial.println ("***ERROR: Received something other than ACK");
+// Send a data packet
+bool TftpServer::sendDataPacket (session_t& session, int8_t slot) {
 
-				}
-			}
-		}
+	packetSlot_t& packet = m_packetSlots[slot];
 
-		// check to see if we should re-send the last data packet
-		else if ((millis() - m_resendStart) > m_timeout) {
+	uint16_t opCode = DATA;
 
-			if (m_serialDebug) Serial.printlnf ("***ERROR: Timeout (%u ms).  Re-sending Data packet %u\t RTT: %f",
-					m_timeout, m_blockNumber, m_rtt);
+	// First 2 bytes of data message are opcode (in front of the block in the packet buffer)
+	packet.header[0] = static_cast <uint8_t> (opCode >> 8);
+	packet.header[1] = static_cast <uint8_t> (opCode);
 
-			// send the same data packet again
-			sendDataPacket ();
+	// Next 2 bytes of ACK message are the block number
+	packet.header[2] = (static_cast <uint8_t> (session.blockNumber >> 8));
+	packet.header[3] = (static_cast <uint8_t> (session.blockNumber));
 
-			// reset the timer
-			m_resendStart = millis();
+	// send the buffer and check for send errors
+	if (sendPacket (*session.socket, reinterpret_cast <uint8_t*> (&packet), 4 + session.blockSize, session.remoteIpAddress, session.remotePort) < 0) {
 
-			// ignore time data for resent packets
-			ignoreTime = true;
+		if (debugOutput()) m_log->println ("***ERROR: Send Failure on sendDataPacket!");
 
-			// increase the transmission count for the exponential back-off
-			m_numberOfRetransmissions++;
+		return false;
+	}
 
-			// increase the timeout exponentially with each retransmission
-			m_timeout *= 2;
+	// take the packet out of the pacing bucket, which never goes below empty
+	uint32_t packetBytes = 4 + session.blockSize;
 
-			// track dropped packets only for debug output
-			if (m_serialDebug) m_droppedPacket++;
+	if (m_paceRate > 0) m_paceTokens = (packetBytes < m_paceTokens) ? m_paceTokens - packetBytes : 0;
 
-			m_timeout = constrain (m_timeout, TIMEOUT_MIN, TIMEOUT_MAX);
+	return true;
+}
 
-			// check to see if we should give up
-			if (m_numberOfRetransmissions >= MAX_RETRANSMISSIONS) {
+// Send an OACK to the client
+bool TftpServer::sendOptionAck (session_t& session) {
 
-				// tell the client we are not getting along
-				sendError (NOT_DEFINED, m_errorTimeoutOnSend, "***ERROR: Timeout on Send");
+	uint16_t opCode = OACK;
 
-				// get us out of here.
-				sendData = false;
-				receivedFinalAck = true;
-				transferComplete = true;
-			}
-		}
-	}
+	// First 2 bytes of OACK message are opcode
+	m_controlPacket[0] = static_cast <uint8_t> (opCode >> 8);
+	m_controlPacket[1] = static_cast <uint8_t> (opCode);
 
-	// close the file
-	m_file.close();
-}
+	size_t length = 2;
 
-// Send a data packet
-bool TftpServer::sendDataPacket () {
+	// followed by the name and value of every option we accepted
+	if (session.blockSizeOptionAccepted) {
 
-	uint16_t opCode = DATA;
+		length += appendOption (&m_controlPacket[length], "blksize", session.negotiatedBlockSize);
+	}
 
-	// First 2 bytes of data message are opcode
-	udpBuffer[0] = static_cast <uint8_t> (opCode >> 8);
-	udpBuffer[1] = static_cast <uint8_t> (opCode);
+	if (session.windowSizeOptionAccepted) {
 
-	// Next 2 bytes of ACK message are the block number
-	udpBuffer[2] = (static_cast <uint8_t> (m_blockNumber >> 8));
-	udpBuffer[3] = (static_cast <uint8_t> (m_blockNumber));
+		length += appendOption (&m_controlPacket[length], "windowsize", session.negotiatedWindowSize);
+	}
+
+	if (session.transferSizeOptionAccepted) {
+
+		length += appendOption (&m_controlPacket[length], "tsize", session.transferSize);
+	}
 
 	// send the buffer and check for send errors
-	if (m_tftp.sendPacket (udpBuffer, 4 + m_blockSize, m_remoteIpAddress, m_remotePort) < 0) {
+	if (sendPacket (*session.socket, m_controlPacket, length, session.remoteIpAddress, session.remotePort) < 0) {
 
-		if (m_serialDebug) Serial.println ("***ERROR: Send Failure on sendDataPacket!");
+		if (debugOutput()) m_log->println ("***ERROR: Send Failure on sendOptionAck!");
 
 		return false;
 	}
@@ -660,22 +2475,22 @@ bool TftpServer::sendDataPacket () {
 }
 
 // Send an ACK to the client
-bool TftpServer::sendAck (uint16_t blockNumber) {
+bool TftpServer::sendAck (session_t& session, uint16_t blockNumber) {
 
 	uint16_t opCode = ACK;
 
 	// First 2 bytes of ACK message are opcode
-	udpBuffer[0] = static_cast <uint8_t> (opCode >> 8);
-	udpBuffer[1] = static_cast <uint8_t> (opCode);
+	m_controlPacket[0] = static_cast <uint8_t> (opCode >> 8);
+	m_controlPacket[1] = static_cast <uint8_t> (opCode);
 
 	// Last 2 bytes of ACK message are the block number
-	udpBuffer[2] = (static_cast <uint8_t> (blockNumber >> 8));
-	udpBuffer[3] = (static_cast <uint8_t> (blockNumber));
+	m_controlPacket[2] = (static_cast <uint8_t> (blockNumber >> 8));
+	m_controlPacket[3] = (static_cast <uint8_t> (blockNumber));
 
 	// send the buffer and check for send errors
-	if (m_tftp.sendPacket (udpBuffer, 4, m_remoteIpAddress, m_remotePort) < 0) {
+	if (sendPacket (*session.socket, m_controlPacket, 4, session.remoteIpAddress, session.remotePort) < 0) {
 
-		if (m_serialDebug) Serial.println ("***ERROR: Send Failure on sendAck!");
+		if (debugOutput()) m_log->println ("***ERROR: Send Failure on sendAck!");
 
 		return false;
 	}
@@ -684,9 +2499,9 @@ bool TftpServer::sendAck (uint16_t blockNumber) {
 }
 
 // send an error message to a client
-bool TftpServer::sendError (uint16_t errorCode, const std::string errorMessage, const char* debugMessage) {
+bool TftpServer::sendError (session_t& session, uint16_t errorCode, const std::string& errorMessage, const char* debugMessage) {
 
-	if (!sendError (errorCode, errorMessage, debugMessage, m_remoteIpAddress, m_remotePort)) {
+	if (!sendError (*session.socket, errorCode, errorMessage, debugMessage, session.remoteIpAddress, session.remotePort)) {
 
 		return false;
 	}
@@ -695,34 +2510,35 @@ bool TftpServer::sendError (uint16_t errorCode, const std::string errorMessage,
 }
 
 // send an error message to a client
-bool TftpServer::sendError (uint16_t errorCode, const std::string errorMessage, const char* debugMessage,
-		IPAddress remoteIpAddress, uint16_t remotePort) {
+bool TftpServer::sendError (TftpSocket& socket, uint16_t errorCode, const std::string& errorMessage, const char* debugMessage,
+		uint32_t remoteIpAddress, uint16_t remotePort) {
 
-	if (m_serialDebug) Serial.println (debugMessage);
+	if (debugOutput()) m_log->println (debugMessage);
 
 	uint16_t opCode = ERROR;
 
 	// First 2 bytes of error message are opcode
-	udpBuffer[0] = static_cast <uint8_t> (opCode >> 8);
-	udpBuffer[1] = static_cast <uint8_t> (opCode);
+	m_controlPacket[0] = static_cast <uint8_t> (opCode >> 8);
+	m_controlPacket[1] = static_cast <uint8_t> (opCode);
 
 	// Next 2 bytes of error message are the error code
-	udpBuffer[2] = (static_cast <uint8_t> (errorCode >> 8));
-	udpBuffer[3] = (static_cast <uint8_t> (errorCode));
+	m_controlPacket[2] = (static_cast <uint8_t> (errorCode >> 8));
+	m_controlPacket[3] = (static_cast <uint8_t> (errorCode));
 
-	// Next set of bytes is an error message
-	for (uint8_t i = 0; i < errorMessage.length(); ++i) {
+	// Next set of bytes is an error message (as much of it as fits)
+	size_t length = errorMessage.length();
 
-		udpBuffer[4 + i] = errorMessage[i];
-	}
+	if (length > TFTP_CONTROL_PACKET_SIZE - 5) length = TFTP_CONTROL_PACKET_SIZE - 5;
+
+	memcpy (&m_controlPacket[4], errorMessage.data(), length);
 
 	// last byte of error packet is a 0
-	udpBuffer[4 + errorMessage.length()] = 0;
+	m_controlPacket[4 + length] = 0;
 
 	// send the buffer and check for send errors
-	if (m_tftp.sendPacket (udpBuffer, 5 + errorMessage.length(), remoteIpAddress, remotePort) < 0) {
+	if (sendPacket (socket, m_controlPacket, 5 + length, remoteIpAddress, remotePort) < 0) {
 
-		if (m_serialDebug) Serial.println ("***ERROR: Send Failure on sendError!");
+		if (debugOutput()) m_log->println ("***ERROR: Send Failure on sendError!");
 
 		return false;
 	}
@@ -736,20 +2552,87 @@ uint16_t TftpServer::readWord() {
 	uint16_t MSB = 0;
 	uint16_t LSB = 0;
 
-	MSB = static_cast <uint16_t> (udpBuffer [m_bufferPosition++] << 8);
-	LSB = udpBuffer [m_bufferPosition++];
+	MSB = static_cast <uint16_t> (m_receiveBuffer [m_bufferPosition++] << 8);
+	LSB = m_receiveBuffer [m_bufferPosition++];
 
 	return (MSB | LSB);
 }
 
-void TftpServer::readText (std::string& buffer) {
 
-	buffer.clear();
+// parse the options that follow the transfer mode
+void TftpServer::readOptions (session_t& session) {
+
+	// RFC 1350 behavior unless the client asks for something else
+	session.negotiatedBlockSize = DEFAULT_BLOCK_SIZE;
+	session.negotiatedWindowSize = 1;
+	session.blockSizeOptionAccepted = false;
+	session.windowSizeOptionAccepted = false;
+	session.transferSizeOptionAccepted = false;
+	session.transferSizeRequested = false;
+	session.transferSize = 0;
+
+	// the parser already split the options into name/value pairs
+	for (uint8_t i = 0; i < m_request.optionCount(); ++i) {
+
+		const char* optionName = m_request.optionName (i);
+
+		// every option we know takes a number, anything else is ignored like a value out of range
+		uint32_t value = 0;
+		bool numeric = TftpRequest::toNumber (m_request.optionValue (i), value);
+
+		// RFC 2348 block size (option names are case insensitive)
+		if (strcasecmp (optionName, "blksize") == 0) {
+
+			uint32_t blockSize = value;
+
+			// values outside of the valid range are ignored and the default is used
+			if (numeric && blockSize >= BLOCK_SIZE_MIN && blockSize <= BLOCK_SIZE_MAX) {
+
+				// never agree to more than our buffer can hold
+				session.negotiatedBlockSize = constrain (blockSize, BLOCK_SIZE_MIN, static_cast <uint32_t> (TFTP_MAX_BLOCK_SIZE));
+				session.blockSizeOptionAccepted = true;
+			}
+		}
+
+		// RFC 7440 window size (only used for RRQ since the client sets the pace on a WRQ)
+		else if (strcasecmp (optionName, "windowsize") == 0 && m_opCode == RRQ) {
+
+			uint32_t windowSize = value;
+
+			// values outside of the valid range are ignored and lock-step is used
+			if (numeric && windowSize >= WINDOW_SIZE_MIN && windowSize <= WINDOW_SIZE_MAX) {
+
+				// never agree to more than we can track
+				session.negotiatedWindowSize = constrain (windowSize, WINDOW_SIZE_MIN, static_cast <uint32_t> (TFTP_MAX_WINDOW_SIZE));
+				session.windowSizeOptionAccepted = true;
+			}
+		}
+
+		// RFC 2349 transfer size.  A RRQ sends 0 and gets the file size back, a WRQ tells
+		// us the size of the upload.  The size of a NETASCII file on the wire isn't known
+		// until it has been sent, so the option is left out for those unless the file
+		// has a NETASCII index.
+		else if (strcasecmp (optionName, "tsize") == 0) {
+
+			// a size that isn't a number is ignored
+			if (!numeric) continue;
 
-	// read in characters of a string until a 0 byte (NULL) is found
-	while (udpBuffer [m_bufferPosition] != 0)
-		buffer.push_back (udpBuffer [m_bufferPosition++]);
+			session.transferSizeRequested = true;
+
+			if (m_opCode == WRQ || !isNetascii (session)) {
+
+				session.transferSize = value;
+				session.transferSizeOptionAccepted = true;
+			}
+		}
+
+		else {
+
+			if (debugOutput()) m_log->printlnf ("Ignoring unsupported option: %s", optionName);
+		}
+	}
 
-	// move past the 0
-	m_bufferPosition++;
+	// any accepted option has to be confirmed with an OACK
+	session.optionAckRequired = session.blockSizeOptionAccepted || session.windowSizeOptionAccepted ||
+			session.transferSizeOptionAccepted;
 }
@@ -40,6 +40,13 @@
  * the client request is taken care of and then control will pass back to the calling
  * function.
  *
+ * To keep loop() running on time, step() does the same as poll() but returns once a
+ * time budget is used up.
+ *
+ * Alternatively poll() can be called from loop() instead.  It never blocks: each call
+ * starts a transfer for any new request and moves every transfer in progress forward,
+ * so several clients can be served at once while the rest of loop() keeps running.
+ *
  * In order to have files to send, this library relies on the SdFat-Particle
  * library.  A pointer to an SdFat object is passed as part of begin() so the
  * TFTP server will have access to the SD card without having to create it's own
@@ -52,13 +59,38 @@
  *
  * The attempt has been made to stick as close to the TFTP protocol as possible.
  * Timeouts were implemented as best I could figure out because the
- * specification doesn't cover timeouts and retransmission explicitly.  Also, to make
- * like simpler with the limited number of sockets available, the transfer ID for the
- * server is kept at 69 rather than choosing a new random port number.
+ * specification doesn't cover timeouts and retransmission explicitly.  Each transfer
+ * gets its own socket on a random ephemeral port which serves as the server transfer
+ * ID, as the specification describes.  Up to TFTP_MAX_SESSIONS transfers run at once.
  *
  * The specification can be located at: https://tools.ietf.org/html/rfc1350
  *
- * @note A buffer size of 516 bytes is allocated for TFTP transfers
+ * The block size option (RFC 2348) is supported for both RRQ and WRQ.  When a client
+ * asks for a larger block size the server answers with an option acknowledgment (OACK,
+ * RFC 2347) and runs the whole transfer at the negotiated size.  The largest block size
+ * the server will agree to is set at compile time by TFTP_MAX_BLOCK_SIZE, which also
+ * sizes the packet buffer so RAM use stays bounded.
+ *
+ * The window size option (RFC 7440) is supported for RRQ.  Up to windowsize DATA
+ * blocks are sent back to back and the client acknowledges the whole window with a
+ * single ACK.  When a block is lost the server rolls back to the last acknowledged
+ * block and sends the window again, rebuilding each block from the file so no extra
+ * packet buffers are needed.  TFTP_MAX_WINDOW_SIZE caps what the server agrees to.
+ *
+ * The transfer size option (RFC 2349) is supported for both.  A RRQ in OCTET mode gets
+ * the size of the file in the OACK.  When a WRQ announces its size the file is given
+ * one contiguous run of clusters up front, so the FAT doesn't grow one cluster at a
+ * time while blocks arrive, and an upload that won't fit is refused with "disk full"
+ * before any data is sent.
+ *
+ * While the server waits for an ACK it reads the next block into the read buffer of
+ * the transfer, so the SD card read overlaps with the network round trip and the block
+ * goes out as soon as the ACK arrives.
+ *
+ * Small files that are read often can be served from RAM, see TftpCache.h and the
+ * cacheSize parameter of begin().
+ *
+ * @note A buffer size of TFTP_MAX_BLOCK_SIZE + 4 bytes is allocated for TFTP transfers
  *
  * @note Library developed using ARM GCC 5.3
  *
@@ -84,12 +116,187 @@
  *         ----------------------------------------
  *  ERROR | 05    |  ErrorCode |   ErrMsg   |   0  |
  *         ----------------------------------------
+ *
+ * From RFC 2347:
+ *
+ *         2 bytes   string   1 byte  string   1 byte        string   1 byte  string   1 byte
+ *         ------------------------------------------------------------------------------------
+ *  RRQ/  | 01/02 | Filename |  0  |  Mode  |  0  |  ...  |  OptN  |  0  |  ValueN  |  0  |
+ *  WRQ    ------------------------------------------------------------------------------------
+ *         2 bytes  string   1 byte  string  1 byte        string   1 byte  string   1 byte
+ *         ---------------------------------------------------------------------------------
+ *  OACK  | 06    |  Opt1  |  0  |  Value1  |  0  |  ...  |  OptN  |  0  |  ValueN  |  0  |
+ *         ---------------------------------------------------------------------------------
  */
 
 #ifndef _TFTPSERVER_H_
 #define _TFTPSERVER_H_
 
 #include <SdFat.h>
+#include <TftpNetascii.h>
+#include <TftpPlatform.h>
+#include <TftpCache.h>
+#include <TftpNetasciiIndex.h>
+#include <TftpProvider.h>
+#include <TftpDirectoryIndex.h>
+#include <TftpRequest.h>
+#include <TftpTrace.h>
+
+/**
+ * Largest block size the server will agree to during blksize negotiation (RFC 2348).
+ *
+ * The default of 1468 bytes fills one Ethernet MTU (1500 - 20 IP - 8 UDP - 4 TFTP).
+ * Use 1428 on networks with extra encapsulation, or go larger only if the network
+ * stack allows IP fragmentation.  The packet buffers are sized from this value.
+ */
+#ifndef TFTP_MAX_BLOCK_SIZE
+#define TFTP_MAX_BLOCK_SIZE 1468
+#endif
+
+/**
+ * Largest window size the server will agree to during windowsize negotiation (RFC 7440).
+ *
+ * Blocks in the window are sent again straight from their packet buffer while there are
+ * enough of them (see TFTP_PACKET_SLOTS).  Blocks that didn't get one are re-read from
+ * the file, so each extra block of window only costs a few bytes of RAM for its file
+ * position.
+ */
+#ifndef TFTP_MAX_WINDOW_SIZE
+#define TFTP_MAX_WINDOW_SIZE 8
+#endif
+
+/**
+ * Number of transfers that can run at the same time.
+ *
+ * Every transfer uses its own UDP socket on top of the one listening on the TFTP
+ * port, so keep this well below the number of sockets the device supports.
+ */
+#ifndef TFTP_MAX_SESSIONS
+#define TFTP_MAX_SESSIONS 3
+#endif
+
+/**
+ * Milliseconds an upload stays around after its final ACK, 0 to end it right away.
+ *
+ * If the final ACK gets lost the client sends the last block again, and only a server
+ * that is still listening can ACK it so the client knows the file arrived.  A session
+ * that is dallying is handed to a new request when no other one is free.
+ */
+#ifndef TFTP_FINAL_ACK_DALLY
+#define TFTP_FINAL_ACK_DALLY 3000
+#endif
+
+/**
+ * Number of DATA packet buffers in the pool of each server, TFTP_MAX_BLOCK_SIZE + 4
+ * bytes each.  A block read for a RRQ stays in its buffer until it is ACKed so a
+ * retransmit sends the same packet again without touching the file.
+ *
+ * Every transfer owns one buffer and borrows the rest while they are free.  The
+ * default gives each transfer room for the block in flight and the one read ahead
+ * of its ACK.  TFTP_MAX_SESSIONS * (TFTP_MAX_WINDOW_SIZE + 1) buffers keep every
+ * block of every window, and blocks that didn't get a buffer are re-read instead.
+ */
+#ifndef TFTP_PACKET_SLOTS
+#define TFTP_PACKET_SLOTS (2 * TFTP_MAX_SESSIONS)
+#endif
+
+/**
+ * Number of requests that wait for a free transfer slot when TFTP_MAX_SESSIONS
+ * transfers are already running.  They are started in the order they arrived and only
+ * requests beyond this get a "server busy" error.  0 turns the backlog off.
+ */
+#ifndef TFTP_REQUEST_BACKLOG
+#define TFTP_REQUEST_BACKLOG 4
+#endif
+
+/**
+ * Longest RRQ/WRQ (file name, mode and options) that can wait in the backlog
+ */
+#ifndef TFTP_REQUEST_SIZE
+#define TFTP_REQUEST_SIZE 256
+#endif
+
+/**
+ * Longest file name (including the terminating null) a request can ask for
+ */
+#ifndef TFTP_FILE_NAME_SIZE
+#define TFTP_FILE_NAME_SIZE 128
+#endif
+
+/**
+ * Size of the buffer ACK, OACK and ERROR packets are built in.  Longer error
+ * messages are cut short.
+ */
+#ifndef TFTP_CONTROL_PACKET_SIZE
+#define TFTP_CONTROL_PACKET_SIZE 128
+#endif
+
+/**
+ * Size of the write-behind buffer each transfer uses to collect WRQ blocks before
+ * they are written to the SD card.  It has to hold a full block on top of a partial
+ * sector, so it must be at least TFTP_MAX_BLOCK_SIZE + 511 bytes.
+ *
+ * @see setWriteDurability()
+ */
+#ifndef TFTP_WRITE_BUFFER_SIZE
+#define TFTP_WRITE_BUFFER_SIZE 2048
+#endif
+
+/**
+ * Features built into the server.  Anything set to 0 is left out at compile time:
+ * its branches fold away and the code behind them is dropped by the linker, which
+ * saves flash and per-packet work on builds that don't need it.
+ *
+ * TFTP_ENABLE_DEBUG     Serial debug output (still switched on by begin())
+ * TFTP_ENABLE_NETASCII  NETASCII transfers, OCTET is always supported
+ * TFTP_ENABLE_RRQ       Reading files (GET), 0 makes a write-only server
+ * TFTP_ENABLE_WRQ       Writing files (PUT), 0 makes a read-only server
+ * TFTP_ENABLE_RAW_SD    Multi-block SD card transfers that bypass the file system
+ *
+ * Requests for something that is left out are answered with "illegal operation".
+ */
+#ifndef TFTP_ENABLE_DEBUG
+#define TFTP_ENABLE_DEBUG 1
+#endif
+
+#ifndef TFTP_ENABLE_NETASCII
+#define TFTP_ENABLE_NETASCII 1
+#endif
+
+#ifndef TFTP_ENABLE_RRQ
+#define TFTP_ENABLE_RRQ 1
+#endif
+
+#ifndef TFTP_ENABLE_WRQ
+#define TFTP_ENABLE_WRQ 1
+#endif
+
+#ifndef TFTP_ENABLE_RAW_SD
+#define TFTP_ENABLE_RAW_SD 1
+#endif
+
+/**
+ * Number of file providers that can be registered with addProvider()
+ */
+#ifndef TFTP_MAX_PROVIDERS
+#define TFTP_MAX_PROVIDERS 4
+#endif
+
+/**
+ * Longest name or prefix (including the terminating null) a provider can be registered under
+ */
+#ifndef TFTP_PROVIDER_NAME_SIZE
+#define TFTP_PROVIDER_NAME_SIZE 32
+#endif
+
+/**
+ * Number of buckets in the round trip time histogram of getStats().  Bucket 0 counts
+ * round trips under 1 ms and bucket n those from 2^(n-1) up to 2^n ms, except for
+ * the last bucket which counts everything longer.
+ */
+#ifndef TFTP_RTT_HISTOGRAM_BUCKETS
+#define TFTP_RTT_HISTOGRAM_BUCKETS 12
+#endif
 
 /**
  * @class TftpServer
@@ -98,24 +305,103 @@ class TftpServer {
 
 public:
 
+	/**
+	 * @enum durability_t
+	 * When data received by a WRQ is forced out to the SD card
+	 */
+	enum durability_t {
+		SYNC_EVERY_BLOCK    = 0, ///< Write and sync every block before it is ACKed (default)
+		SYNC_EVERY_INTERVAL = 1, ///< Buffer blocks and sync after every syncInterval bytes
+		SYNC_ON_CLOSE       = 2  ///< Buffer blocks and only sync when the file is complete
+	};
+
+	/**
+	 * @struct transferStats_t
+	 * What happened during one transfer.  Times are in milliseconds unless noted.
+	 */
+	struct transferStats_t {
+		bool write;                  ///< true for a WRQ, false for a RRQ
+		bool completed;              ///< true if every block made it, false if the transfer was aborted
+		uint32_t bytes;              ///< DATA payload bytes, each block counted once
+		uint32_t blocks;             ///< DATA blocks, each counted once
+		uint32_t retransmissions;    ///< DATA (RRQ) or ACK (WRQ) packets that had already been sent once
+		uint32_t timeouts;           ///< retransmission timer expiries
+		uint32_t duplicatePackets;   ///< ACKs (RRQ) or DATA (WRQ) for blocks already handled
+		uint32_t outOfOrderPackets;  ///< ACKs short of the window (RRQ) or DATA ahead of the next block (WRQ)
+		uint32_t rttSamples;         ///< round trips measured
+		uint32_t rttMin;             ///< shortest round trip
+		uint32_t rttMax;             ///< longest round trip
+		uint32_t rttTotal;           ///< sum of all round trips, divide by rttSamples for the average
+		uint32_t sdMicros;           ///< microseconds spent reading or writing the SD card
+		uint32_t throttledMicros;    ///< microseconds a RRQ could have sent but was held back by pacing
+		uint32_t ackWaitMicros;      ///< microseconds a RRQ had sent its window and waited for the ACK
+		uint32_t elapsed;            ///< time from the request to the end of the transfer
+	};
+
+	/**
+	 * @struct serverStats_t
+	 * Totals over every transfer since begin() or resetStats()
+	 */
+	struct serverStats_t {
+		uint32_t reads;              ///< RRQs started
+		uint32_t writes;             ///< WRQs started
+		uint32_t completed;          ///< transfers that finished
+		uint32_t aborted;            ///< transfers that ended with an error or timeout
+		uint32_t rejected;           ///< requests turned away because the server was busy
+		uint32_t queued;             ///< requests that had to wait in the backlog
+		uint32_t expired;            ///< requests dropped from the backlog because the client went quiet
+		uint32_t cacheHits;          ///< RRQs served from the RAM cache
+		uint32_t bytesSent;          ///< DATA payload bytes sent by RRQs
+		uint32_t bytesReceived;      ///< DATA payload bytes received by WRQs
+		uint32_t retransmissions;    ///< see transferStats_t
+		uint32_t timeouts;           ///< see transferStats_t
+		uint32_t duplicatePackets;   ///< see transferStats_t
+		uint32_t outOfOrderPackets;  ///< see transferStats_t
+		uint32_t sdMicros;           ///< microseconds spent on the SD card, wraps after about 71 minutes
+		uint32_t throttledMicros;    ///< see transferStats_t, wraps like sdMicros
+		uint32_t ackWaitMicros;      ///< see transferStats_t, wraps like sdMicros
+		uint32_t rttHistogram[TFTP_RTT_HISTOGRAM_BUCKETS]; ///< round trips by duration, see TFTP_RTT_HISTOGRAM_BUCKETS
+	};
+
 	/**
 	 * Start the TFTP server.
 	 *
 	 * @param sd pointer to an SdFat instance for access to the file system
 	 * @param portNum TFTP port number.  69 by default.
 	 * @param serialDebug Set true for debug information on serial.  False by default.
-	 * @return True if UDP.begin() is successful, false otherwise.
+	 * @param cacheSize Bytes of RAM to keep small, frequently read files in.  0 (the
+	 * default) turns the cache off.
+	 * @return True if the TFTP port could be opened, false otherwise.
 	 *
 	 * @note Default port number for TFTP protocol is port 69 and should not be changed
 	 * unless you can change the port number expected on the TFTP client.
 	 */
-	bool begin(SdFat* sd, bool serialDebug = false, uint16_t portNum = 69);
+	bool begin(SdFat* sd, bool serialDebug = false, uint16_t portNum = 69, size_t cacheSize = 0);
+
+	/**
+	 * Start the TFTP server on a network, clock and debug output of your choosing
+	 * instead of the ones of the platform the library is built for.
+	 *
+	 * @param sd pointer to an SdFat instance for access to the file system
+	 * @param network Where the sockets come from
+	 * @param clock Time source for timeouts and round trip times
+	 * @param log Where debug information goes
+	 * @param serialDebug Set true for debug information.  False by default.
+	 * @param portNum TFTP port number.  69 by default.
+	 * @param cacheSize Bytes of RAM for the file cache.  0 by default.
+	 * @return True if the TFTP port could be opened, false otherwise.
+	 *
+	 * @see TftpPlatform.h
+	 */
+	bool begin(SdFat* sd, TftpNetwork& network, TftpClock& clock, TftpLog& log,
+			bool serialDebug = false, uint16_t portNum = 69, size_t cacheSize = 0);
 	
 	/**
 	 * Stop the TFTP server and the UDP instance created within as well as any
 	 * files that may be open.
 	 *
-	 * @note this will free up the UDP socket used by the library
+	 * @note this will free up the UDP sockets used by the library and abandon any
+	 * transfers in progress
 	 *
 	 * @warning this will require calling begin again before any TFTP transfers can take place
 	 */
@@ -138,10 +424,203 @@ public:
 	 * This method will respond to a client connecting to the TFTP server by
 	 * performing the required actions.
 	 *
-	 * @note This method will block loop() until finished with the clients request
+	 * @note This method will block loop() until finished with the clients request.
+	 * Requests from other clients that arrive in the meantime are served as well and
+	 * the method returns once every transfer is finished.
+	 *
+	 * @see poll() for a version that does not block
 	 */
 	void processRequest();
 
+	/**
+	 * Move every transfer forward without blocking.
+	 *
+	 * New requests on the TFTP port are given their own transfer (up to
+	 * TFTP_MAX_SESSIONS at a time) and every transfer in progress sends, receives
+	 * and checks its timeouts.  Call it from loop() as often as possible instead
+	 * of checkForPacket() and processRequest().  A transfer on contiguous sectors
+	 * keeps its multi-block SD command open between calls, so call releaseCard()
+	 * before the sketch uses the SD card itself.
+	 *
+	 * @return True while at least one transfer is in progress, false otherwise.
+	 */
+	bool poll();
+
+	/**
+	 * Move every transfer forward for at most budgetMicros microseconds.
+	 *
+	 * Does the same work as poll() (new requests, sends, read-ahead, ACKs and timeouts)
+	 * but checks the clock after every packet or block and returns once the budget is
+	 * used up, so the rest of loop() keeps its timing while a transfer runs.  A single
+	 * step of work (one SD card read or write) can still overrun a small budget, and
+	 * at least one step is always taken so transfers never stall.  Transfers take turns
+	 * going first so one busy client can't use up every budget.  Like poll() it can
+	 * return with a multi-block SD command open, see releaseCard().
+	 *
+	 * @param budgetMicros Time the call may take in microseconds
+	 * @return True while work is pending: a transfer is in progress and step() should
+	 * be called again soon.  False when the server is idle.
+	 */
+	bool step(uint32_t budgetMicros);
+
+	/**
+	 * End the multi-block SD command of a transfer on contiguous sectors.
+	 *
+	 * Call it before the sketch reads or writes the SD card between calls of poll()
+	 * or step().  The transfer picks up where it left off at the next call, without
+	 * erasing its sectors again.
+	 *
+	 * @return True on success or False if the card didn't end the command.
+	 */
+	bool releaseCard();
+
+	/**
+	 * Choose how uploads (WRQ) trade speed for safety.
+	 *
+	 * With SYNC_EVERY_BLOCK every block is written and synced to the SD card before
+	 * it is ACKed, so each block costs a full directory/FAT update.  The other policies
+	 * ACK a block as soon as it is in RAM and collect blocks in a write-behind buffer
+	 * (TFTP_WRITE_BUFFER_SIZE bytes per transfer).  Whole sectors are written out right
+	 * after the ACK goes out, while the client is sending the next block.  The final
+	 * block is only ACKed once the complete file has been written and synced, so a
+	 * successful upload is always safely on the card.
+	 *
+	 * With either buffered policy an OCTET upload that announces its size (tsize) and
+	 * uses a block size that is a multiple of 512 skips the file system altogether.
+	 * The file is created as one contiguous run of sectors and every block is streamed
+	 * into them with a multi-block write, so each DATA packet costs one SPI burst and
+	 * no FAT or directory updates.  The file size is fixed up when the upload ends.
+	 *
+	 * @param durability When to sync the file to the SD card
+	 * @param syncInterval Number of bytes between syncs for SYNC_EVERY_INTERVAL
+	 *
+	 * @note a power loss in the middle of a buffered upload loses up to
+	 * TFTP_WRITE_BUFFER_SIZE bytes plus whatever was written since the last sync
+	 */
+	void setWriteDurability(durability_t durability, uint32_t syncInterval = 0);
+
+	/**
+	 * Set the range the retransmission timeout is kept in.
+	 *
+	 * The timeout follows the round trip time of each transfer (RFC 6298) but never
+	 * goes below timeoutMin, which keeps short spikes on fast networks from causing
+	 * retransmits, or above timeoutMax.  The defaults are 50 ms and 10 s.
+	 *
+	 * @param timeoutMin Shortest timeout in milliseconds
+	 * @param timeoutMax Longest timeout in milliseconds
+	 */
+	void setTimeoutRange(uint32_t timeoutMin, uint32_t timeoutMax);
+
+	/**
+	 * Keep a block index next to every file sent in NETASCII mode.
+	 *
+	 * The first complete NETASCII RRQ of a file writes name + TFTP_NETASCII_INDEX_SUFFIX
+	 * with where every block starts in the file and the state of the NETASCII encoder
+	 * there.  Later RRQs at the same block size go back to a block for a retransmit with
+	 * one seek into the index, and use it to answer the tsize option, which otherwise
+	 * can't be known for NETASCII until the whole file has been converted.  An index is
+	 * ignored (and rebuilt) once the file changes.  While this is on index files can't be
+	 * read or written by clients.  Off by default since it writes to the card during a RRQ.
+	 *
+	 * @param enable True to build and use NETASCII indexes
+	 */
+	void setNetasciiIndex(bool enable) { m_netasciiIndex = enable; }
+
+	/**
+	 * Keep an index of the root directory in RAM.
+	 *
+	 * Finding a file on the card means scanning the directory, which gets slow with
+	 * thousands of files.  The index is read once, when this is called after begin()
+	 * or by begin() itself, and costs about 5 bytes per file.  Requests then open their
+	 * file straight from its directory entry and names that aren't there are answered
+	 * with "file not found" without touching the card.  Uploads add their file.  Files
+	 * the sketch creates itself have to be added with indexFile() (or the directory
+	 * read again with this call) before they can be downloaded.  Uploads always check
+	 * the card, so they never overwrite a file the index doesn't know.  If the
+	 * directory holds more than maxFiles files the index stays off.
+	 *
+	 * @param maxFiles Most files to index, 0 turns the index off (default)
+	 * @return True if the index is on (or was turned off)
+	 */
+	bool setDirectoryIndex(uint16_t maxFiles);
+
+	/**
+	 * Add a file the sketch created to the directory index.  Removed files need
+	 * nothing, the index notices when it opens them.
+	 *
+	 * @param name Name of the file
+	 * @return True if the file is on the card
+	 */
+	bool indexFile(const char* name);
+
+	/**
+	 * Record every packet sent and received in a ring buffer.
+	 *
+	 * Each packet takes 16 bytes (see TftpTrace.h), requests a few more, and the buffer
+	 * keeps the most recent ones.  Its size should be a multiple of 16.  Register the
+	 * buffer as a file with addProvider() to fetch the trace over TFTP, then play it
+	 * back on a PC with tftpreplay.
+	 *
+	 * @param trace Where the records go, NULL turns tracing off (default)
+	 */
+	void setTrace(TftpRingBufferProvider* trace) { m_trace = trace; }
+
+	/**
+	 * Pace DATA packets with a token bucket shared by every transfer.
+	 *
+	 * Sending a whole window (or several transfers) back to back can overflow the
+	 * transmit queue of the WiFi module, and those drops come back as timeouts.  With
+	 * pacing on, a DATA packet only goes out once the bucket holds enough bytes for a
+	 * full block.  The bucket fills at bytesPerSecond and holds up to burstBytes, so
+	 * set the rate just below what the link can carry.  Time held back shows up as
+	 * throttledMicros in the statistics, next to the time spent waiting for ACKs.
+	 *
+	 * @param bytesPerSecond Long term sending rate including the 4 byte header, 0 turns pacing off (default)
+	 * @param burstBytes Most bytes sent back to back, at least one full packet
+	 */
+	void setPacing(uint32_t bytesPerSecond, uint32_t burstBytes);
+
+	/**
+	 * Serve a file from code instead of the SD card.
+	 *
+	 * Requests for the name (or, with prefix set, any name starting with it) go to the
+	 * provider and never touch the card.  An exact name wins over a prefix and a longer
+	 * prefix over a shorter one.  The provider must stay around while the server runs.
+	 *
+	 * @param name File name or prefix, shorter than TFTP_PROVIDER_NAME_SIZE
+	 * @param provider Where the data comes from and goes to
+	 * @param prefix True to match every name that starts with name
+	 * @return False if the name is too long or TFTP_MAX_PROVIDERS are already registered
+	 */
+	bool addProvider(const char* name, TftpFileProvider* provider, bool prefix = false);
+
+	/**
+	 * Totals over every transfer.  Collecting them only costs a few additions per
+	 * packet so they are always on.
+	 *
+	 * @return Server statistics
+	 */
+	const serverStats_t& getStats() const { return m_stats; }
+
+	/**
+	 * Start the totals of getStats() over
+	 */
+	void resetStats();
+
+	/**
+	 * Statistics of a transfer in progress so far
+	 *
+	 * @param index Transfer slot from 0 to TFTP_MAX_SESSIONS - 1
+	 * @param stats Where the statistics are copied to
+	 * @return True if a transfer is running in that slot, false otherwise.
+	 */
+	bool getTransferStats(uint8_t index, transferStats_t& stats) const;
+
+	/**
+	 * @return Statistics of the transfer that ended last
+	 */
+	const transferStats_t& getLastTransferStats() const { return m_lastTransferStats; }
+
 
 private:
 
@@ -154,7 +633,8 @@ private:
 		WRQ   = 2, ///< Write request (WRQ)
 		DATA  = 3, ///< Data (DATA)
 		ACK   = 4, ///< Acknowledgment (ACK)
-		ERROR = 5  ///< Error (ERROR)
+		ERROR = 5, ///< Error (ERROR)
+		OACK  = 6  ///< Option acknowledgment (OACK)
 	};
 
 	/**
@@ -172,36 +652,235 @@ private:
 		NO_USER           = 7, ///< No such user.
 	};
 
-	// UDP variables
-	UDP m_tftp;
-	int16_t m_bufferCount;
+	/**
+	 * @enum sessionState_t
+	 * enum to contain what a session slot is currently doing
+	 */
+	enum sessionState_t {
+		SESSION_FREE  = 0, ///< Slot is not in use
+		SESSION_READ  = 1, ///< Sending a file to the client (RRQ)
+		SESSION_WRITE = 2, ///< Receiving a file from the client (WRQ)
+		SESSION_DALLY = 3  ///< Upload done, waiting in case the final ACK got lost
+	};
+
+	/**
+	 * @enum transferMode_t
+	 * enum to contain the transfer mode of a session, decided once when it starts
+	 */
+	enum transferMode_t {
+		MODE_UNSUPPORTED = 0, ///< Unknown mode (or left out of this build)
+		MODE_OCTET       = 1, ///< Binary transfer
+		MODE_NETASCII    = 2  ///< Text transfer with \r\n line endings
+	};
+
+	/**
+	 * @struct blockRecord_t
+	 * Where a block in the send window starts so it can be rebuilt for a retransmit
+	 */
+	struct blockRecord_t {
+		uint32_t filePosition;  ///< file position of the first byte of the block
+		uint8_t netasciiState;  ///< NETASCII encoder state when the block was read
+		int8_t slot;            ///< packet buffer still holding the block, -1 if it has to be re-read
+		uint16_t length;        ///< number of data bytes in the block
+		uint32_t sentTime;      ///< millis() when the block last went out
+	};
+
+	/**
+	 * @struct queuedRequest_t
+	 * A RRQ/WRQ waiting for a free transfer slot
+	 */
+	struct queuedRequest_t {
+		uint32_t remoteIpAddress;
+		uint16_t remotePort;
+		uint16_t length;                      ///< bytes in packet
+		uint32_t lastHeard;                   ///< milliseconds, when the client last sent the request
+		uint8_t packet[TFTP_REQUEST_SIZE];    ///< the request as it arrived
+	};
+
+	/**
+	 * @struct packetSlot_t
+	 * One DATA packet.  The header sits right in front of the data so the block is read
+	 * into place and the whole packet goes out from one buffer.
+	 */
+	struct packetSlot_t {
+		uint8_t header[4];                    ///< opcode and block number
+		uint8_t data[TFTP_MAX_BLOCK_SIZE];    ///< file data
+	};
+
+	/**
+	 * @struct session_t
+	 * Everything needed to run one transfer.  Each session talks to its client
+	 * from its own UDP port (transfer ID) as described in RFC 1350.
+	 */
+	struct session_t {
+
+		sessionState_t state;
+
+		// UDP variables
+		TftpSocket* socket;
+		uint32_t remoteIpAddress;
+		uint16_t remotePort;
+
+		// TFTP variables
+		uint16_t blockNumber;
+		uint16_t blockSize;
+		uint16_t negotiatedBlockSize;
+		uint16_t negotiatedWindowSize;
+		bool blockSizeOptionAccepted;
+		bool windowSizeOptionAccepted;
+		bool transferSizeOptionAccepted;
+		bool transferSizeRequested;
+		uint32_t transferSize;
+		bool optionAckRequired;
+
+		// what happened so far
+		transferStats_t stats;
+		uint32_t startTime;
+		uint16_t highestBlockSent;
+		bool throttled;          ///< the last service call was held back by pacing
+		bool awaitingAck;        ///< the last service call had nothing left to send
+		uint32_t waitSince;      ///< microseconds, start of the last service call
+
+		// RRQ progress
+		bool waitingForOptionAck;
+		bool transferComplete;
+		bool ignoreTime;
+
+		// the window (RFC 7440) is the run of blocks sent since the last one the client acknowledged
+		uint16_t lastAckedBlock;
+		uint16_t blocksInFlight;
+		uint16_t windowStart;
+		blockRecord_t window[TFTP_MAX_WINDOW_SIZE];
+		uint32_t rollbackTime;  ///< when the window last went back to the first unacknowledged block
+		bool partialAck;        ///< the last ACK left blocks in flight
+
+		// Round Trip Time (RTT) calculation variables, in fixed point milliseconds
+		uint32_t smoothedRtt;   ///< SRTT scaled by 8
+		uint32_t rttVariance;   ///< RTTVAR scaled by 4
+		bool rttMeasured;
+		uint32_t rttCalcStart;
+		uint32_t resendStart;
+		uint32_t rttCalcFinish;
+		uint32_t timeout;
+		uint8_t numberOfRetransmissions;
+
+		// File handling
+		File file;
+		char fileName[TFTP_FILE_NAME_SIZE];
+		transferMode_t transferMode;
+		uint32_t filePosition;
+
+		// provider of a generated file, NULL for files on the card
+		TftpFileProvider* provider;
+		TftpVirtualFile virtualFile;
+
+		// sectors of a contiguous file transferred with multi-block SD commands
+		bool rawIo;
+		bool rawErased;
+		uint32_t rawFirstSector;
+		uint32_t rawLastSector;
+
+		// RRQ file cache entry, -1 if the file isn't cached
+		int8_t cacheSlot;
+		bool servingFromCache;
+
+		// NETASCII conversion state carried from one block to the next
+		NetasciiEncoder netasciiEncoder;
+		NetasciiDecoder netasciiDecoder;
+
+		// block index being built or used by a NETASCII RRQ
+		TftpNetasciiIndex netasciiIndex;
+
+		// RRQ read-ahead, the packet buffer of the session is the first one it borrows
+		uint8_t ownSlot;
+		blockRecord_t readBufferRecord;
+		bool blockReady;
+
+		// WRQ write-behind
+		uint8_t writeBuffer[TFTP_WRITE_BUFFER_SIZE];
+		bool preallocated;
+		uint16_t writeBufferCount;
+		uint32_t bytesSinceSync;
+	};
+
+	// UDP variables for the TFTP port and the last packet received
+	TftpSocket* m_tftp = NULL;
+	uint8_t m_receiveBuffer[TFTP_MAX_BLOCK_SIZE + 4 + 1];  ///< one spare byte shows a DATA packet was too big
+	int m_bufferCount;
 	uint16_t m_bufferPosition;
 	uint16_t m_localPort;
-	IPAddress m_remoteIpAddress;
+	uint32_t m_remoteIpAddress;
 	uint16_t m_remotePort;
 
 	// TFTP variables
 	uint16_t m_opCode;
-	uint16_t m_errorCode;
-	uint16_t m_blockNumber;
-	uint16_t m_blockSize;
-	uint16_t m_transferId;
-	uint32_t m_droppedPacket;
-
-	// Round Trip Time (RTT) calculation variables
-	float m_rtt;
-	uint32_t m_rttCalcStart;
-	uint32_t m_resendStart;
-	uint32_t m_rttCalcFinish;
-	uint32_t m_timeout;
-	uint8_t m_numberOfRetransmissions;
+	TftpRequest m_request;
+	session_t m_sessions[TFTP_MAX_SESSIONS];
+
+	// packets on their way out
+	packetSlot_t m_packetSlots[TFTP_PACKET_SLOTS];
+	bool m_packetSlotUsed[TFTP_PACKET_SLOTS];
+	uint8_t m_controlPacket[TFTP_CONTROL_PACKET_SIZE];
+
+	// file data waiting to be converted to NETASCII
+	uint8_t m_netasciiBuffer[TFTP_MAX_BLOCK_SIZE];
 
 	// File handling
-	File m_file;
-	SdFat* m_sd;
-	std::string m_fileName;
-	std::string m_errorString;
-	std::string m_transferMode;
+	SdFat* m_sd = NULL;
+	TftpFileCache m_cache;
+	TftpDirectoryIndex m_directory;
+	uint16_t m_directoryFiles = 0;
+	durability_t m_durability = SYNC_EVERY_BLOCK;
+	bool m_netasciiIndex = false;
+	char m_netasciiIndexName[TFTP_FILE_NAME_SIZE + sizeof (TFTP_NETASCII_INDEX_SUFFIX)];
+
+	// the transfer that has a multi-block SD command open and where it continues
+	session_t* m_rawStream = NULL;
+	uint32_t m_rawNextSector = 0;
+	bool m_rawWriting = false;
+
+	// packet trace, NULL when off
+	TftpRingBufferProvider* m_trace = NULL;
+
+	// DATA packet pacing (token bucket), a rate of 0 means off
+	uint32_t m_paceRate = 0;        // bytes per second
+	uint32_t m_paceBurst = 0;       // bytes
+	uint32_t m_paceTokens = 0;      // bytes
+	uint32_t m_paceRefilled = 0;    // microseconds
+	bool m_paceStarted = false;     // m_paceRefilled has been set by the first paced packet
+	uint32_t m_syncInterval = 0;
+
+	// retransmission timeout limits
+	uint32_t m_timeoutMin = 50;     // milliseconds
+	uint32_t m_timeoutMax = 10000;  // milliseconds
+
+	// time budget of the current step() and which transfer goes first in the next one
+	uint32_t m_stepStart = 0;       // microseconds
+	uint32_t m_stepBudget = 0xFFFFFFFF;
+	uint8_t m_nextSession = 0;
+
+	// generated files
+	struct providerEntry_t {
+		char name[TFTP_PROVIDER_NAME_SIZE];
+		bool prefix;
+		TftpFileProvider* provider;
+	};
+
+	providerEntry_t m_providers[TFTP_MAX_PROVIDERS] = {};
+	uint8_t m_providerCount = 0;
+
+	// requests waiting for a free session, oldest first
+	queuedRequest_t m_backlog[TFTP_REQUEST_BACKLOG > 0 ? TFTP_REQUEST_BACKLOG : 1];
+	uint8_t m_backlogCount = 0;
+
+	// platform the server runs on
+	TftpNetwork* m_network = NULL;
+	TftpClock* m_clock = NULL;
+	TftpLog* m_log = NULL;
+
+	// statistics
+	serverStats_t m_stats = {};
+	transferStats_t m_lastTransferStats = {};
 
 	// debug output
 	bool m_serialDebug;
@@ -218,13 +897,91 @@ private:
 	const std::string m_errorNoSuchUser = "no such user";
 	const std::string m_errorNetasciiNotSupported = "netascii not supported";
 	const std::string m_errorTimeoutOnSend = "timeout on send";
+	const std::string m_errorTimeoutOnReceive = "timeout on receive";
+	const std::string m_errorServerBusy = "server busy";
+	const std::string m_errorFileNameTooLong = "file name too long";
 
 	/**
 	 * Adaptive updating of the UDP round trip time
 	 *
-	 * @note timeout is constrained between 10 ms and 500 ms (just because)
+	 * Keeps a smoothed round trip time and its variation (RFC 6298) in integer math
+	 * and sets the timeout to SRTT + 4 * RTTVAR.
+	 *
+	 * @param session Transfer the round trip time was measured on
+	 *
+	 * @note timeout is constrained to the range set by setTimeoutRange()
+	 */
+	void updateTimeout(session_t& session);
+
+	/**
+	 * Set the timeout back to SRTT + 4 * RTTVAR after a back-off
+	 *
+	 * @param session Transfer whose client is acknowledging new blocks again
+	 */
+	void resetTimeout(session_t& session);
+
+	/**
+	 * @param session Transfer to check
+	 * @return SRTT + RTTVAR in milliseconds without the limits of setTimeoutRange(),
+	 * or the timeout while there is no round trip time yet
+	 */
+	uint32_t roundTripTimeout(const session_t& session) const;
+
+	/**
+	 * Top up the pacing bucket and check whether a packet may go out
+	 *
+	 * @param length Bytes about to be sent
+	 * @return True if pacing is off or the bucket holds length bytes, false otherwise.
+	 */
+	bool paceAllows(size_t length);
+
+	/**
+	 * @return True if the current step() has time left
+	 */
+	bool budgetLeft() const { return (m_clock->micros() - m_stepStart) < m_stepBudget; }
+
+	/**
+	 * @return True if debug output is built in and was asked for in begin()
+	 */
+	bool debugOutput() const { return TFTP_ENABLE_DEBUG && m_serialDebug; }
+
+	/**
+	 * @param session Transfer to check
+	 * @return True if the transfer converts to and from NETASCII
+	 */
+	bool isNetascii(const session_t& session) const { return TFTP_ENABLE_NETASCII && session.transferMode == MODE_NETASCII; }
+
+	/**
+	 * Add a round trip time measurement to the statistics
+	 *
+	 * @param session Transfer the round trip time was measured on
+	 * @param sample Round trip time in milliseconds
+	 */
+	void recordRtt(session_t& session, uint32_t sample);
+
+	/**
+	 * Double the timeout after a retransmission and stop measuring the round trip
+	 * time until something new is acknowledged (Karn's algorithm).
+	 *
+	 * @param session Transfer that timed out
+	 * @return False once MAX_RETRANSMISSIONS is reached and it is time to give up.
+	 */
+	bool backOff(session_t& session);
+
+	/**
+	 * Receive a packet into the packet buffer
+	 *
+	 * @param socket UDP socket to check
+	 * @return True if a packet has been received, false otherwise.
+	 */
+	bool receivePacket(TftpSocket& socket);
+
+	/**
+	 * Send a packet and add it to the trace
+	 *
+	 * @return Number of bytes sent or negative on a socket error.
 	 */
-	void updateTimeout();
+	int sendPacket(TftpSocket& socket, const uint8_t* packet, size_t length, uint32_t remoteIp, uint16_t remotePort);
 
 	/**
 	 * Read a 2 byte variable from the buffer
@@ -233,63 +990,351 @@ private:
 	 */
 	uint16_t readWord();
 
+
+	/**
+	 * Read the option list (RFC 2347) that follows the transfer mode in a RRQ/WRQ
+	 *
+	 * Recognized options are negotiated and flagged for the OACK.  Unknown options
+	 * are ignored as allowed by the RFC.
+	 *
+	 * @param session Transfer the options apply to
+	 */
+	void readOptions(session_t& session);
+
+	/**
+	 * Start a transfer for the RRQ/WRQ in the packet buffer.
+	 *
+	 * Retransmitted requests for a transfer already in progress or in the backlog are
+	 * ignored.  When every session is in use the request waits in the backlog, and the
+	 * client is only told the server is busy when the backlog is full too.
+	 */
+	void startSession();
+
+	/**
+	 * Put the request in the packet buffer at the end of the backlog
+	 *
+	 * @return True if it was queued, false if the backlog is full or the request too long.
+	 */
+	bool queueRequest();
+
+	/**
+	 * Start waiting requests, oldest first, while there are free sessions and drop the
+	 * ones whose clients stopped asking
+	 */
+	void admitQueuedRequests();
+
+	/**
+	 * Close the file and the UDP socket of a transfer and free its session
+	 *
+	 * @param session Transfer to end
+	 */
+	void endSession(session_t& session);
+
+	/**
+	 * Add a transfer to the statistics and let go of its file, cache entry and packet
+	 * buffers.  The socket stays open.
+	 *
+	 * @param session Transfer that is over
+	 */
+	void finishTransfer(session_t& session);
+
+	/**
+	 * Bind a session to an ephemeral port to use as its transfer ID
+	 *
+	 * @param session Transfer that needs a socket
+	 * @return True on success or False if no port could be opened.
+	 */
+	bool openSocket(session_t& session);
+
+	/**
+	 * Open the requested file and send the OACK if options were negotiated.
+	 *
+	 * @param session Transfer that was just started by a RRQ
+	 */
+	void beginReadRequest(session_t& session);
+
+	/**
+	 * Move a transfer that is sending a file to the client forward.  Sends blocks
+	 * until the window is full, handles ACKs and re-sends on timeout.
+	 *
+	 * @param session Transfer to service
+	 */
+	void serviceReadRequest(session_t& session);
+
 	/**
-	 * Read the next section of text from a TFTP message
+	 * Handle an ACK (or anything else) received on a read transfer
 	 *
-	 * @param buffer string to store the text within
+	 * @param session Transfer the packet in the buffer belongs to
 	 */
-	void readText(std::string& buffer);
+	void handleReadResponse(session_t& session);
 
 	/**
-	 * Handles all the transactions for reading a file from the SD card and sending it
-	 * to the client.
+	 * Read the next block of the file into a packet buffer, converting it to NETASCII if
+	 * that mode was requested.  The block length is left in blockSize and the buffer and
+	 * where the block starts in the file in readBufferRecord.
+	 *
+	 * @param session Transfer to read the block for
+	 * @return True on success or False on a file read error.
+	 */
+	bool readBlock(session_t& session);
+
+	/**
+	 * Read file data for a RRQ from the cache or the SD card.  Data read from the card
+	 * is copied into the cache entry of the transfer if there is one.
+	 *
+	 * @param session Transfer to read for
+	 * @param buffer Where the data goes
+	 * @param count Number of bytes wanted
+	 * @return Number of bytes read, 0 at the end of the file or negative on an error.
 	 */
-	void handleReadRequest();
+	int readFile(session_t& session, uint8_t* buffer, size_t count);
 
 	/**
-	 * Handles all the transactions for getting a file from the client and storing it
-	 * on the SD card.
+	 * Move the read position of a RRQ
+	 *
+	 * @param session Transfer to move
+	 * @param position New file position
 	 */
-	void handleWriteRequest();
+	void seekFile(session_t& session, uint32_t position);
 
 	/**
-	 * Send a data packet to the client.
+	 * Put the file position and NETASCII state back to the start of a block in the window
 	 *
-	 * @param txBuffer The full buffer that is to be sent.
+	 * @param session Transfer to rewind
+	 * @param windowIndex Index of the block in the session window
+	 */
+	void rewindToBlock(session_t& session, uint16_t windowIndex);
+
+	/**
+	 * Send the window again from the block after the last one the client ACKed
+	 *
+	 * @param session RRQ whose client missed a block
+	 */
+	void rollBackWindow(session_t& session);
+
+	/**
+	 * Use the block index of a file sent in NETASCII mode, or start building one if it
+	 * doesn't have a good one and no other transfer is using it already
+	 *
+	 * @param session RRQ that just opened its file
+	 * @param modified Modification time of the file
+	 */
+	void beginNetasciiIndex(session_t& session, uint32_t modified);
+
+	/**
+	 * @param session Transfer to name the index for
+	 * @return Name of the NETASCII index of the file of a transfer, good until the next call
+	 */
+	const char* netasciiIndexName(const session_t& session);
+
+	/**
+	 * @param name File name of a request
+	 * @return The provider registered for the name, NULL for a file on the card
+	 */
+	TftpFileProvider* findProvider(const char* name) const;
+
+	/**
+	 * Open the file of a RRQ, through the directory index when it can tell
+	 *
+	 * @param session RRQ to open the file for
+	 * @return True if the file exists, in which case session.file is open unless
+	 * there was an SD error.  False if there is no such file.
+	 */
+	bool openFile(session_t& session);
+
+	/**
+	 * @param session WRQ about to create its file
+	 * @return True if the file is already on the card, even if the index missed it
+	 */
+	bool fileExists(session_t& session);
+
+	/**
+	 * Hand a request for a generated file to its provider.  The provider still has to
+	 * accept it with openRead() or openWrite().
+	 *
+	 * @param session Transfer that was just started
+	 * @return True if a provider is registered for the file name
+	 */
+	bool openProvider(session_t& session);
+
+	/**
+	 * Borrow a packet buffer for a RRQ.  The session's own buffer comes first, then any
+	 * free one in the pool.  If all are taken, the session's own buffer is taken back
+	 * from a block in its window, which then has to be re-read if it is sent again.
+	 *
+	 * @param session Transfer that needs a buffer
+	 * @return Index of the buffer in the pool
+	 */
+	int8_t acquirePacketSlot(session_t& session);
+
+	/**
+	 * Give a packet buffer back to the pool
+	 *
+	 * @param slot Buffer to give back, -1 does nothing and is returned
+	 * @return -1 so the caller can clear its reference with the result
+	 */
+	int8_t releasePacketSlot(int8_t slot);
+
+	/**
+	 * Create the requested file and accept the WRQ with an ACK or OACK.
+	 *
+	 * @param session Transfer that was just started by a WRQ
+	 */
+	void beginWriteRequest(session_t& session);
+
+	/**
+	 * Move a transfer that is receiving a file from the client forward.  Writes
+	 * every DATA block that has arrived to the SD card and ACKs it.
+	 *
+	 * @param session Transfer to service
+	 */
+	void serviceWriteRequest(session_t& session);
+
+	/**
+	 * Keep listening after the final ACK of an upload (see TFTP_FINAL_ACK_DALLY)
+	 *
+	 * @param session Upload that just stored its last block
+	 */
+	void beginDally(session_t& session);
+
+	/**
+	 * ACK the last block again if the client resends it, and end the session once
+	 * the dally period is over
+	 *
+	 * @param session Dallying upload
+	 */
+	void serviceDally(session_t& session);
+
+	/**
+	 * Save the DATA block in the packet buffer according to the durability policy
+	 *
+	 * @param session Transfer the block belongs to
+	 * @param finalBlock True if this is the last block of the file
+	 * @return True on success or False on a file write error.
+	 */
+	bool storeBlock(session_t& session, bool finalBlock);
+
+	/**
+	 * Write the write-behind buffer to the SD card
+	 *
+	 * @param session Transfer to flush
+	 * @param flushAll True to write everything, false to only write whole sectors once
+	 * another block no longer fits in the buffer
+	 * @return True on success or False on a file write error.
+	 */
+	bool flushWriteBuffer(session_t& session, bool flushAll);
+
+	/**
+	 * Cut a WRQ file created at its announced size down to what arrived and sync it
+	 *
+	 * @param session Transfer that just received its last block
+	 * @return True on success or False on a file write error.
+	 */
+	bool finishFile(session_t& session);
+
+	/**
+	 * Create the file of a WRQ as one contiguous run of sectors for multi-block writes
+	 *
+	 * @param session WRQ that announced its size
+	 * @return True if the file was created, false to fall back to a normal file
+	 */
+	bool createRawFile(session_t& session);
+
+	/**
+	 * Stream a block straight into the sectors of the file
+	 *
+	 * @param session WRQ writing a contiguous file
+	 * @param finalBlock True for the last block of the file
+	 * @return True on success or False on a card error or more data than announced.
+	 */
+	bool storeRawBlock(session_t& session, bool finalBlock);
+
+	/**
+	 * Make sure the card is in a multi-block command for a transfer at a sector,
+	 * ending whatever other one was open
+	 *
+	 * @param session Transfer that wants the card
+	 * @param sector Sector the next readData() or writeData() goes to
+	 * @param write True for a multi-block write, false for a read
+	 * @return True if the card is ready
+	 */
+	bool startRawStream(session_t& session, uint32_t sector, bool write);
+
+	/**
+	 * Switch an OCTET RRQ of a contiguous file to multi-block reads
+	 *
+	 * @param session RRQ that just opened its file
+	 */
+	void openRawFile(session_t& session);
+
+	/**
+	 * Read file data straight from the sectors of a contiguous file
+	 *
+	 * @param session RRQ reading a contiguous file, at a sector boundary
+	 * @param buffer Where the data goes, with room for count rounded up to whole sectors
+	 * @param count Number of bytes wanted
+	 * @return Number of bytes read, 0 at the end of the file or -1 on a card error
+	 */
+	int readRawSectors(session_t& session, uint8_t* buffer, size_t count);
+
+	/**
+	 * End the open multi-block command, if there is one, so the file system can be used
+	 *
+	 * @return True on success or False on a card error.
+	 */
+	bool stopRawStream();
+
+	/**
+	 * Send a data packet to the client.  The header is written in front of the block
+	 * in its packet buffer.
+	 *
+	 * @param session Transfer the data block belongs to
+	 * @param slot Packet buffer holding the block
 	 * @return True on success or False on send error.
 	 */
-	bool sendDataPacket ();
+	bool sendDataPacket (session_t& session, int8_t slot);
+
+	/**
+	 * This method will generate an OACK message listing every accepted option
+	 *
+	 * @param session Transfer the options were negotiated for
+	 * @return True on success or False on send error.
+	 */
+	bool sendOptionAck (session_t& session);
 
 	/**
 	 * This method will generate an ACK message
 	 *
+	 * @param session Transfer to acknowledge
 	 * @param blockNumber File block number the ACK message refers to
 	 * @return True on success or False on send error.
 	 */
-	bool sendAck (uint16_t blockNumber);
+	bool sendAck (session_t& session, uint16_t blockNumber);
 
 	/**
-	 * Send an error code and message to a client
+	 * Send an error code and message to the client of a transfer
 	 *
+	 * @param session Transfer the error belongs to
 	 * @param errorCode Code corresponding to the TFTP error type
 	 * @param errorMessage String corresponding to the error type
 	 * @param debugMessage String to send to serial when serialDebug is set TRUE in begin()
 	 * @return True on success or False on send error.
 	 */
-	bool sendError (uint16_t errorCode, const std::string errorMessage, const char* debugMessage);
+	bool sendError (session_t& session, uint16_t errorCode, const std::string& errorMessage, const char* debugMessage);
 
 	/**
 	 * Send an error code and message to a client
 	 *
+	 * @param socket UDP socket to send the error from
 	 * @param errorCode Code corresponding to the TFTP error type
 	 * @param errorMessage String corresponding to the error type
 	 * @param debugMessage String to send to serial when serialDebug is set TRUE in begin()
-	 * @param remoteIpAddress IP address to send error message.  Default is sender of RRQ/WRQ
-	 * @param remotePort Port number to send error message.  Default is sender of RRQ/WRQ
+	 * @param remoteIpAddress IP address to send error message
+	 * @param remotePort Port number to send error message
 	 * @return True on success or False on send error.
 	 */
-	bool sendError (uint16_t errorCode, const std::string errorMessage, const char* debugMessage,
-			IPAddress remoteIpAddress, uint16_t remotePort);
+	bool sendError (TftpSocket& socket, uint16_t errorCode, const std::string& errorMessage, const char* debugMessage,
+			uint32_t remoteIpAddress, uint16_t remotePort);
 
 };
 
@@ -0,0 +1,121 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpTrace.cpp
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <TftpTrace.h>
+#include <string.h>
+
+// RRQ and WRQ are the packets worth keeping whole
+static const uint8_t TRACE_RRQ = 1;
+static const uint8_t TRACE_WRQ = 2;
+
+static void putWord (uint8_t* bytes, uint16_t value) {
+
+	bytes[0] = static_cast <uint8_t> (value);
+	bytes[1] = static_cast <uint8_t> (value >> 8);
+}
+
+static void putLong (uint8_t* bytes, uint32_t value) {
+
+	putWord (bytes, static_cast <uint16_t> (value));
+	putWord (&bytes[2], static_cast <uint16_t> (value >> 16));
+}
+
+static uint16_t getWord (const uint8_t* bytes) {
+
+	return static_cast <uint16_t> (bytes[0] | (bytes[1] << 8));
+}
+
+static uint32_t getLong (const uint8_t* bytes) {
+
+	return getWord (bytes) | (static_cast <uint32_t> (getWord (&bytes[2])) << 16);
+}
+
+void TftpTrace::packet (TftpRingBufferProvider& buffer, uint32_t time, bool sent, const uint8_t* packet, size_t length,
+		uint32_t peerAddress, uint16_t peerPort) {
+
+	tftpTraceRecord_t record;
+
+	record.time = time;
+	record.peerAddress = peerAddress;
+	record.peerPort = peerPort;
+	record.opCode = (length >= 2) ? packet[1] : 0;
+	record.block = (length >= 4 && record.opCode != TRACE_RRQ && record.opCode != TRACE_WRQ) ?
+			static_cast <uint16_t> ((packet[2] << 8) | packet[3]) : 0;
+	record.size = static_cast <uint16_t> (length);
+	record.flags = sent ? TFTP_TRACE_SENT : 0;
+
+	uint8_t bytes[TFTP_TRACE_RECORD_SIZE];
+
+	encode (record, bytes);
+	buffer.append (bytes, sizeof (bytes));
+
+	if (sent || length <= 2 || (record.opCode != TRACE_RRQ && record.opCode != TRACE_WRQ)) return;
+
+	// the request itself in 15 byte pieces
+	size_t remaining = length - 2;
+
+	if (remaining > TFTP_TRACE_REQUEST_SIZE) remaining = TFTP_TRACE_REQUEST_SIZE;
+
+	for (size_t position = 2; remaining > 0; ) {
+
+		size_t piece = (remaining < TFTP_TRACE_RECORD_SIZE - 1) ? remaining : TFTP_TRACE_RECORD_SIZE - 1;
+
+		memset (bytes, 0, sizeof (bytes));
+		memcpy (bytes, &packet[position], piece);
+		bytes[TFTP_TRACE_RECORD_SIZE - 1] = TFTP_TRACE_CONTINUATION;
+
+		buffer.append (bytes, sizeof (bytes));
+
+		position += piece;
+		remaining -= piece;
+	}
+}
+
+void TftpTrace::decode (const uint8_t* bytes, tftpTraceRecord_t& record) {
+
+	record.time = getLong (bytes);
+	record.peerAddress = getLong (&bytes[4]);
+	record.peerPort = getWord (&bytes[8]);
+	record.block = getWord (&bytes[10]);
+	record.size = getWord (&bytes[12]);
+	record.opCode = bytes[14];
+	record.flags = bytes[15];
+}
+
+void TftpTrace::encode (const tftpTraceRecord_t& record, uint8_t* bytes) {
+
+	putLong (bytes, record.time);
+	putLong (&bytes[4], record.peerAddress);
+	putWord (&bytes[8], record.peerPort);
+	putWord (&bytes[10], record.block);
+	putWord (&bytes[12], record.size);
+	bytes[14] = record.opCode;
+	bytes[15] = record.flags;
+}
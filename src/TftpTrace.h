@@ -0,0 +1,129 @@
+/**
+ * TftpServer library by Micah L. Abelson
+ *
+ * @name TftpTrace.h
+ * @author Micah Abelson
+ * @date May 20, 2017
+ *
+ * MIT License
+ *
+ * Copyright (c) 2017 Micah L. Abelson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ * @brief Compact record of every packet the server sends and receives
+ *
+ * Each packet becomes one 16 byte record: time in microseconds, the peer, opcode,
+ * block number (the error code for ERROR packets) and size.  Requests are followed by
+ * as many continuation records as it takes to hold the request itself, 15 bytes each,
+ * so a trace can be played back into a server later (host/tftpreplay.cpp).
+ *
+ * Records go into a TftpRingBufferProvider, which keeps the most recent ones and can
+ * be registered as a file so the trace can be fetched from the device over TFTP.
+ * Fields are stored little-endian whatever the byte order of the machine.
+ *
+ *  0  time          uint32  micros() when the packet was sent or received
+ *  4  peer address  uint32  IPv4 address of the other end
+ *  8  peer port     uint16
+ * 10  block         uint16  block number, error code or 0
+ * 12  size          uint16  bytes in the packet
+ * 14  opcode        uint8
+ * 15  flags         uint8   TFTP_TRACE_SENT, TFTP_TRACE_CONTINUATION
+ *
+ * Continuation records carry request bytes (after the opcode) in bytes 0 to 14.
+ */
+
+#ifndef _TFTPTRACE_H_
+#define _TFTPTRACE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <TftpProvider.h>
+
+/**
+ * Bytes per record
+ */
+#define TFTP_TRACE_RECORD_SIZE 16
+
+/**
+ * The server sent the packet, otherwise it received it
+ */
+#define TFTP_TRACE_SENT 0x01
+
+/**
+ * The record holds request bytes instead of a packet
+ */
+#define TFTP_TRACE_CONTINUATION 0x80
+
+/**
+ * Most request bytes kept, longer requests are cut short
+ */
+#ifndef TFTP_TRACE_REQUEST_SIZE
+#define TFTP_TRACE_REQUEST_SIZE 240
+#endif
+
+/**
+ * @struct tftpTraceRecord_t
+ * One packet
+ */
+struct tftpTraceRecord_t {
+	uint32_t time;
+	uint32_t peerAddress;
+	uint16_t peerPort;
+	uint16_t block;
+	uint16_t size;
+	uint8_t opCode;
+	uint8_t flags;
+};
+
+/**
+ * @class TftpTrace
+ */
+class TftpTrace {
+
+public:
+
+	/**
+	 * Add a packet to a trace
+	 *
+	 * @param buffer Ring buffer the trace goes into
+	 * @param time Current time in microseconds
+	 * @param sent True if the server sent the packet
+	 * @param packet The packet
+	 * @param length Bytes in the packet
+	 * @param peerAddress IPv4 address of the other end
+	 * @param peerPort Port of the other end
+	 */
+	static void packet(TftpRingBufferProvider& buffer, uint32_t time, bool sent, const uint8_t* packet, size_t length,
+			uint32_t peerAddress, uint16_t peerPort);
+
+	/**
+	 * @param bytes TFTP_TRACE_RECORD_SIZE bytes of a trace
+	 * @param record Where the fields go
+	 */
+	static void decode(const uint8_t* bytes, tftpTraceRecord_t& record);
+
+	/**
+	 * @param record The fields
+	 * @param bytes Where the TFTP_TRACE_RECORD_SIZE bytes go
+	 */
+	static void encode(const tftpTraceRecord_t& record, uint8_t* bytes);
+};
+
+#endif /* _TFTPTRACE_H_ */